@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <inttypes.h>
 #include <stddef.h>
 #include <string.h>
@@ -7,49 +8,1254 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 #ifdef USE_LIBULZ
 #include <ulz/stdio-repl.h>
 #endif
 
-static int fetch(FILE *f, off_t *cnt) {
-	int c = fgetc(f);
-	if(c >= 0) *cnt = *cnt + 1;
-	return c;
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define BLOCKSIZE (1024*1024)
+
+/* XXH64 */
+#define XP1 0x9E3779B185EBCA87ULL
+#define XP2 0xC2B2AE3D27D4EB4FULL
+#define XP3 0x165667B19E3779F9ULL
+#define XP4 0x85EBCA77C2B2AE63ULL
+#define XP5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl(uint64_t x, int r) {
+	return x << r | x >> (64 - r);
+}
+
+static uint64_t getle(const unsigned char *p, int n) {
+	uint64_t v = 0;
+	while(n--) v = v << 8 | p[n];
+	return v;
+}
+
+static uint64_t get64(const unsigned char *p) {
+	return getle(p, 8);
+}
+
+static uint64_t xround(uint64_t acc, uint64_t in) {
+	return rotl(acc + in * XP2, 31) * XP1;
+}
+
+static uint64_t xmerge(uint64_t h, uint64_t v) {
+	return (h ^ xround(0, v)) * XP1 + XP4;
+}
+
+static uint64_t xxh64(const unsigned char *p, size_t len) {
+	const unsigned char *e = p + len;
+	uint64_t h, v[4] = {XP1 + XP2, XP2, 0, -XP1};
+	if(len >= 32) {
+		for(; e - p >= 32; p += 32) {
+			v[0] = xround(v[0], get64(p));
+			v[1] = xround(v[1], get64(p + 8));
+			v[2] = xround(v[2], get64(p + 16));
+			v[3] = xround(v[3], get64(p + 24));
+		}
+		h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+		h = xmerge(xmerge(xmerge(xmerge(h, v[0]), v[1]), v[2]), v[3]);
+	} else h = XP5;
+	h += len;
+	for(; e - p >= 8; p += 8) h = rotl(h ^ xround(0, get64(p)), 27) * XP1 + XP4;
+	if(e - p >= 4) {
+		h = rotl(h ^ getle(p, 4) * XP1, 23) * XP2 + XP3;
+		p += 4;
+	}
+	for(; p < e; p++) h = rotl(h ^ *p * XP5, 11) * XP1;
+	h = (h ^ h >> 33) * XP2;
+	h = (h ^ h >> 29) * XP3;
+	return h ^ h >> 32;
+}
+
+/* files are checksummed as the XXH64 of the XXH64s of their blocks,
+   so ranges can be hashed in parallel and streams with little memory */
+struct sum {
+	uint64_t *h;
+	size_t n;
+};
+
+static void sum_set(struct sum *s, size_t i, const unsigned char *p, size_t len) {
+	if(i >= s->n) {
+		s->h = realloc(s->h, (i + 1) * sizeof *s->h);
+		memset(s->h + s->n, 0, (i + 1 - s->n) * sizeof *s->h);
+		s->n = i + 1;
+	}
+	s->h[i] = xxh64(p, len);
+}
+
+static uint64_t sum_get(struct sum *s) {
+	unsigned char *b = malloc(s->n * 8 + 1);
+	uint64_t h;
+	size_t i;
+	int k;
+	for(i = 0; i < s->n; i++) for(k = 0; k < 8; k++) b[8*i + k] = s->h[i] >> 8*k;
+	h = xxh64(b, s->n * 8);
+	free(b);
+	return h;
+}
+
+/* a patch is the header
+     "BDPATCH1", source size, target size, source sum, target sum
+   as little endian 64 bit values, then records of the number of bytes
+   to keep from the source, the number of bytes to replace and the new
+   bytes, with the counts as LEB128. two zero counts end it. the target
+   is cut or extended to its size. */
+#define PATCHMAGIC "BDPATCH1"
+#define PATCHHEAD 40
+
+static size_t readall(int fd, unsigned char *buf, size_t n, off_t off) {
+	size_t got = 0;
+	ssize_t r;
+	while(got < n && (r = pread(fd, buf + got, n - got, off + got)) > 0) got += r;
+	return got;
+}
+
+#ifndef BPATCH
+/* length of the equal prefix of a and b. whole pages are skipped with
+   memcmp, the edge is found 16 bytes at a time. */
+static size_t same(const unsigned char *a, const unsigned char *b, size_t n) {
+	size_t i = 0;
+	while(n - i >= 4096 && !memcmp(a + i, b + i, 4096)) i += 4096;
+#ifdef __SSE2__
+	for(; n - i >= 16; i += 16) {
+		unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const void*) (a + i)),
+			_mm_loadu_si128((const void*) (b + i))));
+		if(m != 0xffff) return i + __builtin_ctz(~m);
+	}
+#endif
+	while(i < n && a[i] == b[i]) i++;
+	return i;
+}
+
+/* length of the prefix of a and b in which all bytes differ */
+static size_t differ(const unsigned char *a, const unsigned char *b, size_t n) {
+	size_t i = 0;
+#ifdef __SSE2__
+	for(; n - i >= 16; i += 16) {
+		unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const void*) (a + i)),
+			_mm_loadu_si128((const void*) (b + i))));
+		if(m) return i + __builtin_ctz(m);
+	}
+#endif
+	while(i < n && a[i] != b[i]) i++;
+	return i;
+}
+
+static void sum_init(struct sum *s, size_t n) {
+	s->h = calloc(n + 1, sizeof *s->h);
+	s->n = n;
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+	int i;
+	for(i = 0; i < 8; i++) p[i] = v >> 8*i;
+}
+
+static void put_uleb(FILE *f, uint64_t v) {
+	do fputc((v > 0x7f) << 7 | (v & 0x7f), f);
+	while(v >>= 7);
+}
+
+static FILE *patchf;
+static int patchsrc;
+static off_t patchend;
+static unsigned char *patchbuf;
+
+/* the new bytes are read again from the target file */
+static int patch_run(off_t start, off_t l) {
+	put_uleb(patchf, start - patchend);
+	put_uleb(patchf, l);
+	for(patchend = start + l; l > 0; ) {
+		size_t n = l < BLOCKSIZE ? l : BLOCKSIZE;
+		if(readall(patchsrc, patchbuf, n, start) != n || fwrite(patchbuf, 1, n, patchf) != n) return -1;
+		start += n;
+		l -= n;
+	}
+	return 0;
+}
+
+/* --sync copies the runs from filename1 into filename2. runs are
+   widened to whole multiples of the minimum write, and written
+   together when that makes them touch. */
+static int syncfd = -1, syncsrc, syncerr;
+static const char *syncname;
+static off_t syncmin = 4096, wstart, wend, written;
+static size_t writes;
+
+static int sync_flush(void) {
+	off_t pos;
+	if(wend <= wstart) return 0;
+	for(pos = wstart; pos < wend; ) {
+		size_t n = wend - pos < BLOCKSIZE ? wend - pos : BLOCKSIZE;
+		if(readall(syncsrc, patchbuf, n, pos) != n || pwrite(syncfd, patchbuf, n, pos) != n) return -1;
+		pos += n;
+	}
+	written += wend - wstart;
+	writes++;
+	wstart = wend = 0;
+	return 0;
+}
+
+/* difference runs are merged in offset order. a run continuing at
+   the end of the previous one crossed the boundary of two jobs. */
+static off_t pstart, plen, min, diffbytes;
+static size_t diffs;
+static int patcherr;
+
+/* a run up to the end is reported one byte early, as always */
+static void print_run(off_t start, off_t l) {
+	printf("difference at offset %llu of size %llu\n",
+	       (long long) (start + l == min ? start - 1 : start), (long long) l);
+	diffs++;
+	diffbytes += l;
+	if(patchf && patch_run(start, l)) patcherr = 1;
+	if(syncfd != -1) {
+		off_t s = start / syncmin * syncmin, e = (start + l + syncmin - 1) / syncmin * syncmin;
+		if(e > min) e = min;
+		if(wend > wstart && s <= wend) {
+			if(e > wend) wend = e;
+		} else if(sync_flush()) syncerr = 1;
+		else {
+			wstart = s;
+			wend = e;
+		}
+	}
+}
+
+static void put_run(off_t start, off_t l) {
+	if(plen && start == pstart + plen) {
+		plen += l;
+		return;
+	}
+	if(plen) print_run(pstart, plen);
+	pstart = start;
+	plen = l;
+}
+
+static void end_runs(void) {
+	if(plen) print_run(pstart, plen);
+}
+
+struct job {
+	int f1, f2, err;
+	off_t start, end, skipped;
+	FILE *runs;
+	pthread_t t;
+};
+
+static void job_run(struct job *j, off_t start, off_t l) {
+	off_t r[2] = {start, l};
+	if(!j->runs) put_run(start, l);
+	else if(fwrite(r, sizeof r, 1, j->runs) != 1) j->err = 1;
+}
+
+static struct sum sums[2];
+
+/* ranges known to be equal without reading them: holes in both files,
+   and extents both files share on disk */
+struct range {
+	off_t start, end;
+};
+static struct range *skips;
+static size_t nskips;
+
+static void add_skip(struct range **r, size_t *n, off_t start, off_t end) {
+	if(start >= end) return;
+	if(!(*n & 63)) *r = realloc(*r, (*n + 64) * sizeof **r);
+	(*r)[*n].start = start;
+	(*r)[*n].end = end;
+	++*n;
 }
 
-static int diff(FILE *f1, FILE* f2) {
-	off_t min;
-	size_t diffs = 0;
+/* the holes of fd below end */
+static size_t holes(int fd, off_t end, struct range **r) {
+	off_t pos = 0, data;
+	size_t n = 0;
+	*r = 0;
+	while(pos < end) {
+		/* only ENXIO means no data up to the end, after other errors
+		   the rest is read as data */
+		if((data = lseek(fd, pos, SEEK_DATA)) == -1) {
+			if(errno != ENXIO) break;
+			data = end;
+		}
+		if(data > end) data = end;
+		add_skip(r, &n, pos, data);
+		if(data == end || (pos = lseek(fd, data, SEEK_HOLE)) == -1) break;
+	}
+	return n;
+}
+
+struct extent {
+	off_t start, end, phys;
+	unsigned flags;
+};
+
+/* the mapped extents of fd below end, none if the file system has no
+   FIEMAP. the sync flag writes delayed allocations out first. */
+static size_t extents(int fd, off_t end, struct extent **r) {
+	enum { N = 256 };
+	struct fiemap *fm = malloc(sizeof *fm + N * sizeof(struct fiemap_extent));
+	off_t pos = 0;
+	size_t n = 0;
+	unsigned i;
+	*r = 0;
+	while(pos < end) {
+		memset(fm, 0, sizeof *fm);
+		fm->fm_start = pos;
+		fm->fm_length = end - pos;
+		fm->fm_flags = FIEMAP_FLAG_SYNC;
+		fm->fm_extent_count = N;
+		if(ioctl(fd, FS_IOC_FIEMAP, fm) || !fm->fm_mapped_extents) break;
+		for(i = 0; i < fm->fm_mapped_extents; i++) {
+			struct fiemap_extent *e = &fm->fm_extents[i];
+			if(!(n & 63)) *r = realloc(*r, (n + 64) * sizeof **r);
+			(*r)[n].start = e->fe_logical;
+			(*r)[n].end = e->fe_logical + e->fe_length;
+			(*r)[n].phys = e->fe_physical;
+			(*r)[n].flags = e->fe_flags;
+			n++;
+			pos = e->fe_logical + e->fe_length;
+		}
+		if(fm->fm_extents[i-1].fe_flags & FIEMAP_EXTENT_LAST) break;
+	}
+	free(fm);
+	return n;
+}
+
+/* extents whose physical address is not a plain offset on the device */
+#define FIEMAP_UNSURE (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | \
+	FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_ENCRYPTED | \
+	FIEMAP_EXTENT_NOT_ALIGNED | FIEMAP_EXTENT_DATA_INLINE | \
+	FIEMAP_EXTENT_DATA_TAIL)
+
+static int range_cmp(const void *a, const void *b) {
+	const struct range *x = a, *y = b;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* the parts at the same offset in both files that are holes in both,
+   or map to the same place on the same device */
+static void find_skips(int f1, int f2, off_t end) {
+	struct stat st1, st2;
+	struct range *h1, *h2, *r = 0;
+	struct extent *e1, *e2;
+	size_t n1, n2, i, j, n = 0;
+	n1 = holes(f1, end, &h1);
+	n2 = holes(f2, end, &h2);
+	for(i = j = 0; i < n1 && j < n2; ) {
+		add_skip(&r, &n, h1[i].start > h2[j].start ? h1[i].start : h2[j].start,
+		         h1[i].end < h2[j].end ? h1[i].end : h2[j].end);
+		if(h1[i].end < h2[j].end) i++;
+		else j++;
+	}
+	free(h1);
+	free(h2);
+	if(!fstat(f1, &st1) && !fstat(f2, &st2) && st1.st_dev == st2.st_dev) {
+		n1 = extents(f1, end, &e1);
+		n2 = extents(f2, end, &e2);
+		for(i = j = 0; i < n1 && j < n2; ) {
+			if(!((e1[i].flags | e2[j].flags) & FIEMAP_UNSURE) &&
+			   !((e1[i].flags ^ e2[j].flags) & FIEMAP_EXTENT_UNWRITTEN) &&
+			   e1[i].phys - e1[i].start == e2[j].phys - e2[j].start) {
+				off_t s = e1[i].start > e2[j].start ? e1[i].start : e2[j].start;
+				off_t t = e1[i].end < e2[j].end ? e1[i].end : e2[j].end;
+				add_skip(&r, &n, s, t < end ? t : end);
+			}
+			if(e1[i].end < e2[j].end) i++;
+			else j++;
+		}
+		free(e1);
+		free(e2);
+	}
+	if(!n) return;
+	qsort(r, n, sizeof *r, range_cmp);
+	for(i = 0, nskips = 0; i < n; i++) {
+		if(nskips && r[i].start <= r[nskips-1].end) {
+			if(r[i].end > r[nskips-1].end) r[nskips-1].end = r[i].end;
+		} else r[nskips++] = r[i];
+	}
+	skips = r;
+}
+
+/* a difference run ends at the first equal byte, which belongs to no
+   run, and may span blocks. */
+static void *compare(void *arg) {
+	struct job *j = arg;
+	off_t pos, start = 0, l = 0;
+	size_t s = 0;
+	unsigned char *b1 = malloc(BLOCKSIZE), *b2 = malloc(BLOCKSIZE);
+	if(!b1 || !b2) {
+		j->err = 1;
+		goto out;
+	}
+	for(pos = j->start; pos < j->end; ) {
+		size_t i = 0, n = j->end - pos < BLOCKSIZE ? j->end - pos : BLOCKSIZE;
+		while(s < nskips && skips[s].end <= pos) s++;
+		if(s < nskips && skips[s].start <= pos) {
+			/* equal, so it ends a run */
+			off_t e = skips[s].end < j->end ? skips[s].end : j->end;
+			if(l) job_run(j, start, l);
+			l = 0;
+			j->skipped += e - pos;
+			pos = e;
+			continue;
+		}
+		if(s < nskips && skips[s].start - pos < n) n = skips[s].start - pos;
+		if(readall(j->f1, b1, n, pos) != n || readall(j->f2, b2, n, pos) != n) {
+			perror("read");
+			j->err = 1;
+			goto out;
+		}
+		/* each job has whole blocks, except the one at the end */
+		if(patchf) {
+			sum_set(&sums[0], pos / BLOCKSIZE, b1, n);
+			sum_set(&sums[1], pos / BLOCKSIZE, b2, n);
+		}
+		while(i < n) {
+			if(!l) {
+				i += same(b1 + i, b2 + i, n - i);
+				if(i == n) break;
+				start = pos + i;
+			}
+			size_t k = differ(b1 + i, b2 + i, n - i);
+			l += k;
+			i += k;
+			if(i == n) break;
+			job_run(j, start, l);
+			l = 0;
+			i++;
+		}
+		pos += n;
+	}
+	if(l) job_run(j, start, l);
+out:
+	free(b1);
+	free(b2);
+	return 0;
+}
+
+/* sums the blocks after the common length, and the partial one
+   before it in the longer file */
+static int sum_tail(int fd, struct sum *s, off_t size) {
+	off_t pos;
+	for(pos = min / BLOCKSIZE * BLOCKSIZE; pos < size; pos += BLOCKSIZE) {
+		size_t n = size - pos < BLOCKSIZE ? size - pos : BLOCKSIZE;
+		if(readall(fd, patchbuf, n, pos) != n) return -1;
+		sum_set(s, pos / BLOCKSIZE, patchbuf, n);
+	}
+	return 0;
+}
+
+static int write_patch(int f1, int f2, off_t size1, off_t size2) {
+	unsigned char h[PATCHHEAD];
+	if(size2 > min && patch_run(min, size2 - min)) return -1;
+	put_uleb(patchf, 0);
+	put_uleb(patchf, 0);
+	if(size1 > min && sum_tail(f1, &sums[0], size1)) return -1;
+	if(size2 > min && sum_tail(f2, &sums[1], size2)) return -1;
+	memcpy(h, PATCHMAGIC, 8);
+	put64(h + 8, size1);
+	put64(h + 16, size2);
+	put64(h + 24, sum_get(&sums[0]));
+	put64(h + 32, sum_get(&sums[1]));
+	if(fflush(patchf) || pwrite(fileno(patchf), h, sizeof h, 0) != sizeof h) return -1;
+	return fclose(patchf);
+}
+
+/* the target is then cut or extended to the size of the source */
+static int sync_end(off_t size1, off_t size2, int datasync) {
+	off_t pos;
+	if(sync_flush()) return -1;
+	for(pos = min; pos < size1; ) {
+		size_t n = size1 - pos < BLOCKSIZE ? size1 - pos : BLOCKSIZE;
+		if(readall(syncsrc, patchbuf, n, pos) != n || pwrite(syncfd, patchbuf, n, pos) != n) return -1;
+		pos += n;
+	}
+	if(size1 > min) {
+		written += size1 - min;
+		writes++;
+	}
+	if(size2 > size1 && ftruncate(syncfd, size1)) return -1;
+	if(datasync && fdatasync(syncfd)) return -1;
+	return 0;
+}
+
+static int datasync;
+
+static int diff(int f1, int f2, int njobs) {
 	struct stat st1, st2;
-	if(fstat(fileno(f1), &st1)) return 1;
-	if(fstat(fileno(f2), &st2)) return 1;
+	struct job *jobs;
+	off_t chunk, r[2];
+	off_t skipped = 0;
+	int i, err = 0;
+	if(fstat(f1, &st1)) return 1;
+	if(fstat(f2, &st2)) return 1;
 	min = st1.st_size;
-	off_t p1, p2, l, diffbytes = 0;
 	if (st2.st_size != min) {
 		printf("sizes differ! %llu, %llu\n",
 		       (long long) st1.st_size, (long long) st2.st_size);
 		if (st2.st_size < min) min = st2.st_size;
 	}
-	p1 = 0;
-	p2 = 0;
-	while(p1 < min) {
-		l = 0;
-		while(p1 < min && fetch(f1, &p1) != fetch(f2, &p2)) l++;
-		if(l) {
-			printf("difference at offset %llu of size %llu\n",
-			       (long long) p1-l-1,  (long long) l);
+	/* the first job prints right away, the others keep their runs in
+	   temporary files, which could be too big for memory */
+	/* a patch sums all blocks, so they are all read */
+	if(!patchf) find_skips(f1, f2, min);
+	chunk = ((min + njobs - 1) / njobs + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+	if(chunk < BLOCKSIZE) chunk = BLOCKSIZE;
+	if(patchf) {
+		unsigned char h[PATCHHEAD] = {0};
+		patchsrc = f2;
+		patchbuf = malloc(BLOCKSIZE);
+		/* the jobs fill in the sums without reallocating */
+		sum_init(&sums[0], (st1.st_size + BLOCKSIZE - 1) / BLOCKSIZE);
+		sum_init(&sums[1], (st2.st_size + BLOCKSIZE - 1) / BLOCKSIZE);
+		fwrite(h, 1, sizeof h, patchf);
+	}
+	if(syncfd != -1) {
+		syncsrc = f1;
+		patchbuf = malloc(BLOCKSIZE);
+	}
+	jobs = calloc(njobs, sizeof *jobs);
+	for(i = 0; i < njobs; i++) {
+		jobs[i].f1 = f1;
+		jobs[i].f2 = f2;
+		jobs[i].start = i * chunk < min ? i * chunk : min;
+		jobs[i].end = (i + 1) * chunk < min && i < njobs - 1 ? (i + 1) * chunk : min;
+		if(i && !(jobs[i].runs = tmpfile())) {
+			perror("tmpfile");
+			return 1;
+		}
+		if(i && pthread_create(&jobs[i].t, 0, compare, &jobs[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	compare(&jobs[0]);
+	err = jobs[0].err;
+	skipped = jobs[0].skipped;
+	for(i = 1; i < njobs; i++) {
+		pthread_join(jobs[i].t, 0);
+		err |= jobs[i].err;
+		skipped += jobs[i].skipped;
+		rewind(jobs[i].runs);
+		while(!err && fread(r, sizeof r, 1, jobs[i].runs) == 1) put_run(r[0], r[1]);
+		fclose(jobs[i].runs);
+	}
+	free(jobs);
+	if(err) return 1;
+	end_runs();
+	if(patchf && (patcherr || write_patch(f1, f2, st1.st_size, st2.st_size))) {
+		perror("writing patch");
+		return 1;
+	}
+	if(syncfd != -1 && (syncerr || sync_end(st1.st_size, st2.st_size, datasync))) {
+		perror(syncname);
+		return 1;
+	}
+	if(syncfd != -1)
+		printf("%llu bytes written to %s in %zu writes.\n", (long long) written, syncname, writes);
+	if(skipped) printf("%llu bytes in holes or shared extents were not read.\n", (long long) skipped);
+	printf("%zu differences in %llu out of %llu bytes detected.\n",
+	        diffs, (long long) diffbytes, (long long) min);
+	return diffs != 0;
+}
+
+
+/* --quick compares samples: the first and the last block and random
+   aligned blocks between them. samples in ranges known to be equal
+   are not read. the first thread to find a difference stops all. */
+static off_t quickbs = 65536;
+static size_t nsamples = 1024;
+static volatile int qstop;
+static off_t qdiff = -1;
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
+
+struct qjob {
+	int f1, f2, err;
+	off_t *at, size;
+	size_t n;
+	pthread_t t;
+};
+
+static int skipped_at(off_t pos, off_t end) {
+	size_t lo = 0, hi = nskips;
+	while(lo < hi) {
+		size_t m = (lo + hi) / 2;
+		if(skips[m].end <= pos) lo = m + 1;
+		else hi = m;
+	}
+	return lo < nskips && skips[lo].start <= pos && skips[lo].end >= end;
+}
+
+static void *sample(void *arg) {
+	struct qjob *j = arg;
+	unsigned char *b1 = malloc(quickbs), *b2 = malloc(quickbs);
+	size_t i;
+	for(i = 0; b1 && b2 && i < j->n && !qstop; i++) {
+		off_t pos = j->at[i];
+		size_t n = j->size - pos < quickbs ? j->size - pos : quickbs, k;
+		if(skipped_at(pos, pos + n)) continue;
+		if(readall(j->f1, b1, n, pos) != n || readall(j->f2, b2, n, pos) != n) {
+			perror("read");
+			j->err = 1;
+			break;
+		}
+		if((k = same(b1, b2, n)) < n) {
+			pthread_mutex_lock(&qlock);
+			if(qdiff == -1 || pos + k < qdiff) qdiff = pos + k;
+			qstop = 1;
+			pthread_mutex_unlock(&qlock);
+		}
+	}
+	if(!b1 || !b2) j->err = 1;
+	free(b1);
+	free(b2);
+	return 0;
+}
+
+static uint64_t rnd(uint64_t *x) {
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static int off_cmp(const void *a, const void *b) {
+	off_t x = *(const off_t*) a, y = *(const off_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+/* the smallest share of differing blocks that k samples find with 99%
+   confidence, f with (1 - f)^k = 0.01 */
+static double share(size_t k) {
+	double lo = 0, hi = 1;
+	int i;
+	for(i = 0; i < 60; i++) {
+		double f = (lo + hi) / 2, x = 1 - f, p = 1;
+		size_t e;
+		for(e = k; e; e >>= 1, x *= x) if(e & 1) p *= x;
+		if(p > 0.01) lo = f;
+		else hi = f;
+	}
+	return hi;
+}
+
+static int quick(int f1, int f2, int njobs) {
+	struct stat st1, st2;
+	struct qjob *jobs;
+	off_t *at, nblk;
+	size_t n, i, per;
+	uint64_t x;
+	int err = 0;
+	if(fstat(f1, &st1) || fstat(f2, &st2)) return 1;
+	if(st1.st_size != st2.st_size) {
+		printf("sizes differ! %llu, %llu\n", (long long) st1.st_size, (long long) st2.st_size);
+		return 1;
+	}
+	if(st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino) {
+		printf("equal, both names are the same file.\n");
+		return 0;
+	}
+	find_skips(f1, f2, st1.st_size);
+	if(!st1.st_size || (nskips == 1 && !skips[0].start && skips[0].end == st1.st_size)) {
+		printf("equal, all data is shared on disk or a hole.\n");
+		return 0;
+	}
+	nblk = (st1.st_size + quickbs - 1) / quickbs;
+	n = nsamples + 2 < nblk ? nsamples + 2 : nblk;
+	at = malloc(n * sizeof *at);
+	if(n == nblk) for(i = 0; i < n; i++) at[i] = i * quickbs;
+	else {
+		x = (time(0) ^ (uint64_t) getpid() << 32) | 1;
+		at[0] = 0;
+		at[1] = (nblk - 1) * quickbs;
+		for(i = 2; i < n; i++) at[i] = rnd(&x) % nblk * quickbs;
+		qsort(at, n, sizeof *at, off_cmp);
+	}
+	per = (n + njobs - 1) / njobs;
+	jobs = calloc(njobs, sizeof *jobs);
+	for(i = 0; i < njobs; i++) {
+		jobs[i].f1 = f1;
+		jobs[i].f2 = f2;
+		jobs[i].size = st1.st_size;
+		jobs[i].at = at + (i * per < n ? i * per : n);
+		jobs[i].n = (i + 1) * per < n ? per : i * per < n ? n - i * per : 0;
+		if(i && pthread_create(&jobs[i].t, 0, sample, &jobs[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	sample(&jobs[0]);
+	err = jobs[0].err;
+	for(i = 1; i < njobs; i++) {
+		pthread_join(jobs[i].t, 0);
+		err |= jobs[i].err;
+	}
+	if(err) return 1;
+	if(qdiff != -1) {
+		printf("difference at offset %llu\n", (long long) qdiff);
+		return 1;
+	}
+	if(n == nblk) printf("equal, all %zu blocks were compared.\n", n);
+	else printf("probably equal, %zu of %llu blocks were compared: a difference in more than %.2g%% of the blocks is found with 99%% confidence.\n",
+	            n, (long long) nblk, share(n) * 100);
+	return 0;
+}
+
+/* content defined comparison, like rsync: the blocks of file1 are
+   hashed into a table, and a window rolling over file2 is looked up in
+   it. matching windows become segments, which are extended to the exact
+   edges byte by byte. the segments in increasing order in both files
+   are kept in place, the others were moved. file2 bytes outside of all
+   segments were inserted, file1 bytes outside of them deleted. */
+struct seg {
+	off_t p, q, l;	/* offset in file1, in file2, length */
+	int keep;
+};
+
+struct block {
+	uint32_t weak;
+	uint64_t strong;
+};
+
+static struct block *blocks;
+static size_t nblocks, *table, tmask, shiftbs = 4096;
+
+static uint32_t weak_sum(const unsigned char *p, size_t n, uint32_t *a, uint32_t *b) {
+	size_t i;
+	*a = *b = 0;
+	for(i = 0; i < n; i++) {
+		*a += p[i];
+		*b += (n - i) * p[i];
+	}
+	return (*a & 0xffff) | *b << 16;
+}
+
+static int shift_index(int f1, off_t size) {
+	unsigned char *buf = malloc(shiftbs);
+	uint32_t a, b;
+	size_t i, h;
+	nblocks = size / shiftbs;
+	blocks = malloc(nblocks * sizeof *blocks);
+	for(tmask = 1; tmask < 2 * nblocks; tmask <<= 1);
+	table = calloc(tmask--, sizeof *table);
+	if(!buf || !blocks || !table) return -1;
+	for(i = 0; i < nblocks; i++) {
+		if(readall(f1, buf, shiftbs, i * shiftbs) != shiftbs) return -1;
+		blocks[i].weak = weak_sum(buf, shiftbs, &a, &b);
+		blocks[i].strong = xxh64(buf, shiftbs);
+		/* of equal blocks only the first is in the table */
+		for(h = blocks[i].weak * 0x9e3779b1u & tmask; table[h]; h = (h + 1) & tmask)
+			if(blocks[table[h]-1].weak == blocks[i].weak && blocks[table[h]-1].strong == blocks[i].strong)
+				break;
+		if(!table[h]) table[h] = i + 1;
+	}
+	free(buf);
+	return 0;
+}
+
+/* the block matching the window, preferring the one after the last match */
+static size_t lookup(uint32_t weak, const unsigned char *w, size_t want) {
+	uint64_t strong = 0;
+	size_t h;
+	int have = 0;
+	if(want && want <= nblocks && blocks[want-1].weak == weak) {
+		strong = xxh64(w, shiftbs);
+		have = 1;
+		if(blocks[want-1].strong == strong) return want;
+	}
+	for(h = weak * 0x9e3779b1u & tmask; table[h]; h = (h + 1) & tmask) {
+		struct block *bl = &blocks[table[h] - 1];
+		if(bl->weak != weak) continue;
+		if(!have++) strong = xxh64(w, shiftbs);
+		if(bl->strong == strong) return table[h];
+	}
+	return 0;
+}
+
+static struct seg *segs;
+static size_t nsegs;
+
+static void add_seg(off_t p, off_t q, off_t l) {
+	if(nsegs && segs[nsegs-1].p + segs[nsegs-1].l == p && segs[nsegs-1].q + segs[nsegs-1].l == q) {
+		segs[nsegs-1].l += l;
+		return;
+	}
+	if(!(nsegs & (nsegs + 1))) segs = realloc(segs, (2 * nsegs + 1) * sizeof *segs);
+	segs[nsegs++] = (struct seg) {p, q, l, 0};
+}
+
+static int shift_scan(int f2) {
+	size_t cap = BLOCKSIZE + shiftbs, have = 0, w = 0, bl, want = 0;
+	unsigned char *buf = malloc(cap);
+	uint32_t a = 0, b = 0, weak = 0;
+	off_t base = 0;	/* file offset of buf[0] */
+	ssize_t r;
+	int fresh = 1, eof = 0;
+	if(!buf) return -1;
+	for(;;) {
+		if(w + shiftbs > have) {
+			if(eof) break;
+			memmove(buf, buf + w, have - w);
+			base += w;
+			have -= w;
+			w = 0;
+			while(have < cap && (r = read(f2, buf + have, cap - have)) > 0) have += r;
+			if(have < cap) eof = 1;
+			continue;
+		}
+		if(fresh) {
+			weak = weak_sum(buf + w, shiftbs, &a, &b);
+			fresh = 0;
+		}
+		if((bl = lookup(weak, buf + w, want))) {
+			add_seg((off_t) (bl - 1) * shiftbs, base + w, shiftbs);
+			want = bl + 1;
+			w += shiftbs;
+			fresh = 1;
+			continue;
+		}
+		/* roll the window one byte on */
+		if(w + shiftbs >= have) {
+			w++;
+			fresh = 1;
+			continue;
+		}
+		a += buf[w + shiftbs] - buf[w];
+		b += a - shiftbs * buf[w];
+		weak = (a & 0xffff) | b << 16;
+		w++;
+	}
+	free(buf);
+	return 0;
+}
+
+/* number of equal bytes of f1 at p and f2 at q, forward or backward */
+static off_t extend(int f1, off_t p, int f2, off_t q, off_t max, int back) {
+	unsigned char b1[4096], b2[4096];
+	off_t got = 0;
+	while(got < max) {
+		size_t n = max - got < 4096 ? max - got : 4096, i;
+		off_t o1 = back ? p - got - n : p + got, o2 = back ? q - got - n : q + got;
+		if(readall(f1, b1, n, o1) != n || readall(f2, b2, n, o2) != n) break;
+		if(!back) {
+			i = same(b1, b2, n);
+			got += i;
+			if(i < n) break;
+			continue;
+		}
+		for(i = n; i && b1[i-1] == b2[i-1]; i--);
+		got += n - i;
+		if(i) break;
+	}
+	return got;
+}
+
+/* marks the longest chain of segments increasing in both files */
+static void keep_chain(void) {
+	size_t *tail = malloc((nsegs + 1) * sizeof *tail), *prev = malloc(nsegs * sizeof *prev);
+	size_t i, n = 0, lo, hi;
+	for(i = 0; i < nsegs; i++) {
+		for(lo = 0, hi = n; lo < hi; ) {
+			size_t m = (lo + hi) / 2;
+			if(segs[tail[m]].p < segs[i].p) lo = m + 1;
+			else hi = m;
+		}
+		prev[i] = lo ? tail[lo-1] : (size_t) -1;
+		tail[lo] = i;
+		if(lo == n) n++;
+	}
+	for(i = n ? tail[n-1] : (size_t) -1; i != (size_t) -1; i = prev[i]) segs[i].keep = 1;
+	free(tail);
+	free(prev);
+}
+
+static int seg_cmp_p(const void *a, const void *b) {
+	const struct seg *x = a, *y = b;
+	return x->p < y->p ? -1 : x->p > y->p;
+}
+
+/* what is reported, at p/l1 in file1 and q/l2 in file2 */
+enum { INSERT, DELETE, CHANGE, MOVE };
+struct event {
+	off_t p, q, l1, l2;
+	int type;
+};
+
+static struct event *evs;
+static size_t nevs;
+
+static void add_event(int type, off_t p, off_t l1, off_t q, off_t l2) {
+	if(!(nevs & (nevs + 1))) evs = realloc(evs, (2 * nevs + 1) * sizeof *evs);
+	evs[nevs++] = (struct event) {p, q, l1, l2, type};
+}
+
+static int ev_cmp(const void *a, const void *b) {
+	const struct event *x = a, *y = b;
+	if(x->q != y->q) return x->q < y->q ? -1 : 1;
+	return x->p < y->p ? -1 : x->p > y->p;
+}
+
+static int shift_diff(int f1, int f2) {
+	struct stat st1, st2;
+	off_t end1, end2, bytes[4] = {0}, inplace = 0;
+	size_t i, j, n[4] = {0};
+	if(fstat(f1, &st1) || fstat(f2, &st2)) return 1;
+	if(shift_index(f1, st1.st_size) || shift_scan(f2)) {
+		perror("reading");
+		return 1;
+	}
+	free(table);
+	free(blocks);
+	keep_chain();
+	/* empty kept segments at both ends find equal starts and ends */
+	add_seg(st1.st_size, st2.st_size, 0);
+	segs[nsegs-1].keep = 1;
+	add_seg(0, 0, 0);
+	memmove(segs + 1, segs, (nsegs - 1) * sizeof *segs);
+	segs[0] = (struct seg) {0, 0, 0, 1};
+	/* extend the segments to the exact edges, kept ones only up to the
+	   kept ones around them in file1 */
+	for(end1 = end2 = i = 0; i < nsegs; i++) {
+		struct seg *s = &segs[i];
+		off_t lim1 = s->keep ? s->p - end1 : s->p, lim2 = i ? s->q - segs[i-1].q - segs[i-1].l : 0, k;
+		k = extend(f1, s->p, f2, s->q, lim1 < lim2 ? lim1 : lim2, 1);
+		s->p -= k;
+		s->q -= k;
+		s->l += k;
+		for(j = i + 1; j < nsegs && !segs[j].keep; j++);
+		lim1 = (s->keep && j < nsegs ? segs[j].p : st1.st_size) - s->p - s->l;
+		lim2 = (i + 1 < nsegs ? segs[i+1].q : st2.st_size) - s->q - s->l;
+		s->l += extend(f1, s->p + s->l, f2, s->q + s->l, lim1 < lim2 ? lim1 : lim2, 0);
+		if(s->keep) end1 = s->p + s->l;
+	}
+	/* in the order of file2: insertions and moves */
+	for(end1 = end2 = i = 0; i < nsegs; i++) {
+		if(segs[i].q > end2) add_event(INSERT, end1, 0, end2, segs[i].q - end2);
+		if(segs[i].q + segs[i].l > end2) end2 = segs[i].q + segs[i].l;
+		if(segs[i].keep) {
+			end1 = segs[i].p + segs[i].l;
+			inplace += segs[i].l;
+		} else add_event(MOVE, segs[i].p, segs[i].l, segs[i].q, segs[i].l);
+	}
+	/* in the order of file1: deletions, at the position in file2
+	   after the last kept segment before them */
+	qsort(segs, nsegs, sizeof *segs, seg_cmp_p);
+	for(end1 = end2 = i = 0; i < nsegs; i++) {
+		if(segs[i].p > end1) add_event(DELETE, end1, segs[i].p - end1, end2, 0);
+		if(segs[i].p + segs[i].l > end1) end1 = segs[i].p + segs[i].l;
+		if(segs[i].keep) end2 = segs[i].q + segs[i].l;
+	}
+	/* an insertion and a deletion at the same place are a change */
+	qsort(evs, nevs, sizeof *evs, ev_cmp);
+	for(i = j = 0; i < nevs; i++) {
+		if(j && evs[i].q == evs[j-1].q && evs[i].p == evs[j-1].p
+		   && evs[i].type + evs[j-1].type == INSERT + DELETE) {
+			evs[j-1].l1 += evs[i].l1;
+			evs[j-1].l2 += evs[i].l2;
+			evs[j-1].type = CHANGE;
+			continue;
+		}
+		evs[j++] = evs[i];
+	}
+	for(i = 0; i < j; i++) {
+		struct event *e = &evs[i];
+		switch(e->type) {
+		case INSERT:
+			printf("insertion at offset %llu of size %llu in file2, at offset %llu in file1\n",
+			       (long long) e->q, (long long) e->l2, (long long) e->p);
+			break;
+		case DELETE:
+			printf("deletion at offset %llu of size %llu in file1, at offset %llu in file2\n",
+			       (long long) e->p, (long long) e->l1, (long long) e->q);
+			break;
+		case CHANGE:
+			printf("change at offset %llu of size %llu in file1 to size %llu at offset %llu in file2\n",
+			       (long long) e->p, (long long) e->l1, (long long) e->l2, (long long) e->q);
+			break;
+		case MOVE:
+			printf("move of size %llu from offset %llu in file1 to offset %llu in file2\n",
+			       (long long) e->l1, (long long) e->p, (long long) e->q);
+			break;
+		}
+		n[e->type]++;
+		bytes[e->type] += e->l1 > e->l2 ? e->l1 : e->l2;
+	}
+	printf("%zu insertions of %llu bytes, %zu deletions of %llu bytes, %zu changes of %llu bytes, "
+	       "%zu moves of %llu bytes, %llu bytes in place.\n",
+	       n[INSERT], (long long) bytes[INSERT], n[DELETE], (long long) bytes[DELETE],
+	       n[CHANGE], (long long) bytes[CHANGE], n[MOVE], (long long) bytes[MOVE], (long long) inplace);
+	return j != 0;
+}
+
+/* a manifest is the header
+     "BDHASHM1", file size, block size
+   as little endian 64 bit values, then the XXH64 of each block */
+#define MANIFESTMAGIC "BDHASHM1"
+#define MANIFESTHEAD 24
+
+struct hjob {
+	int fd, err;
+	off_t size;
+	size_t bs, first, last;
+	uint64_t *h;
+	pthread_t t;
+};
+
+/* small blocks are read many at a time */
+static void *hash_blocks(void *arg) {
+	struct hjob *j = arg;
+	size_t chunk = j->bs >= BLOCKSIZE ? j->bs : BLOCKSIZE / j->bs * j->bs;
+	unsigned char *b = malloc(chunk);
+	size_t i = j->first;
+	if(!b) j->err = 1;
+	while(b && i < j->last) {
+		off_t pos = (off_t) i * j->bs;
+		size_t n = j->size - pos < chunk ? j->size - pos : chunk, k;
+		if((off_t) (j->last - i) * j->bs < n) n = (j->last - i) * j->bs;
+		if(readall(j->fd, b, n, pos) != n) {
+			perror("read");
+			j->err = 1;
+			break;
+		}
+		for(k = 0; k < n; k += j->bs, i++) j->h[i] = xxh64(b + k, n - k < j->bs ? n - k : j->bs);
+	}
+	free(b);
+	return 0;
+}
+
+/* the block hashes of fd, computed by njobs threads */
+static uint64_t *hash_file(int fd, off_t size, size_t bs, size_t *nblk, int njobs) {
+	size_t n = (size + bs - 1) / bs, per;
+	uint64_t *h = malloc((n + 1) * sizeof *h);
+	struct hjob *jobs = calloc(njobs, sizeof *jobs);
+	int i, err = 0;
+	per = (n + njobs - 1) / njobs;
+	for(i = 0; i < njobs; i++) {
+		jobs[i] = (struct hjob) {.fd = fd, .size = size, .bs = bs, .h = h};
+		jobs[i].first = i * per < n ? i * per : n;
+		jobs[i].last = (i + 1) * per < n ? (i + 1) * per : n;
+		if(i && pthread_create(&jobs[i].t, 0, hash_blocks, &jobs[i])) {
+			perror("pthread_create");
+			return 0;
+		}
+	}
+	hash_blocks(&jobs[0]);
+	err = jobs[0].err;
+	for(i = 1; i < njobs; i++) {
+		pthread_join(jobs[i].t, 0);
+		err |= jobs[i].err;
+	}
+	free(jobs);
+	if(err) {
+		free(h);
+		return 0;
+	}
+	*nblk = n;
+	return h;
+}
+
+static int write_manifest(const char *out, int fd, size_t bs, int njobs) {
+	unsigned char b[MANIFESTHEAD];
+	struct stat st;
+	uint64_t *h;
+	size_t n, i;
+	FILE *f;
+	if(fstat(fd, &st) || !(h = hash_file(fd, st.st_size, bs, &n, njobs))) return 1;
+	if(!(f = fopen(out, "w"))) {
+		perror(out);
+		return 1;
+	}
+	memcpy(b, MANIFESTMAGIC, 8);
+	put64(b + 8, st.st_size);
+	put64(b + 16, bs);
+	fwrite(b, 1, sizeof b, f);
+	for(i = 0; i < n; i++) {
+		put64(b, h[i]);
+		fwrite(b, 1, 8, f);
+	}
+	if(fclose(f)) {
+		perror(out);
+		return 1;
+	}
+	return 0;
+}
+
+/* differences are found at block granularity. a block cut by the end
+   of the shorter file differs, as its hash covers more bytes. */
+static int against(const char *mf, int fd, int njobs) {
+	unsigned char b[MANIFESTHEAD];
+	struct stat st;
+	uint64_t *h, size, bs;
+	size_t n, m, i;
+	FILE *f;
+	if(!(f = fopen(mf, "r"))) {
+		perror(mf);
+		return 1;
+	}
+	if(fread(b, 1, sizeof b, f) != sizeof b || memcmp(b, MANIFESTMAGIC, 8) || !(bs = get64(b + 16))) {
+		dprintf(2, "%s: not a manifest\n", mf);
+		return 1;
+	}
+	size = get64(b + 8);
+	if(fstat(fd, &st) || !(h = hash_file(fd, st.st_size, bs, &n, njobs))) return 1;
+	min = size;
+	if(st.st_size != min) {
+		printf("sizes differ! %llu, %llu\n", (long long) size, (long long) st.st_size);
+		if(st.st_size < min) min = st.st_size;
+	}
+	m = (min + bs - 1) / bs;
+	for(i = 0; i < m; i++) {
+		if(fread(b, 1, 8, f) != 8) {
+			dprintf(2, "%s: truncated manifest\n", mf);
+			return 1;
+		}
+		if(get64(b) == h[i] && ((off_t) (i + 1) * bs <= min || size == st.st_size)) continue;
+		off_t start = (off_t) i * bs, l = (off_t) (i + 1) * bs < min ? bs : min - start;
+		if(plen && start == pstart + plen) plen += l;
+		else {
+			if(plen) printf("difference at offset %llu of size %llu\n", (long long) pstart, (long long) plen);
+			pstart = start;
+			plen = l;
 			diffs++;
-			diffbytes += l;
 		}
+		diffbytes += l;
 	}
+	if(plen) printf("difference at offset %llu of size %llu\n", (long long) pstart, (long long) plen);
+	fclose(f);
 	printf("%zu differences in %llu out of %llu bytes detected.\n",
 	        diffs, (long long) diffbytes, (long long) min);
 	return diffs != 0;
 }
 
+/* n-way comparison: the copies are read in lockstep with the
+   reference, one block of each at a time. a range is reported where
+   the set of copies differing from the reference is the same. */
+#define MAXCOPIES 64
+
+static off_t mstart, mlen, mbytes[MAXCOPIES+1];
+static uint64_t mmask;
+
+static void multi_flush(void) {
+	int k;
+	if(!mmask) return;
+	printf("difference at offset %llu of size %llu in", (long long) mstart, (long long) mlen);
+	for(k = 1; k <= MAXCOPIES; k++) if(mmask >> (k - 1) & 1) {
+		printf(" %d", k);
+		mbytes[k] += mlen;
+	}
+	putchar('\n');
+	diffs++;
+	diffbytes += mlen;
+}
+
+static void multi_run(off_t start, off_t l, uint64_t m) {
+	if(m == mmask && start == mstart + mlen) {
+		mlen += l;
+		return;
+	}
+	multi_flush();
+	mstart = start;
+	mlen = l;
+	mmask = m;
+}
+
+static int multi_diff(int nf, char **names) {
+	int fd[MAXCOPIES+1], k;
+	unsigned char *b[MAXCOPIES+1];
+	size_t e[MAXCOPIES+1];
+	off_t pos, size[MAXCOPIES+1];
+	struct stat st;
+	if(nf > MAXCOPIES + 1) {
+		dprintf(2, "at most %d copies\n", MAXCOPIES);
+		return 1;
+	}
+	for(k = 0; k < nf; k++) {
+		if((fd[k] = open(names[k], O_RDONLY)) == -1 || fstat(fd[k], &st) || !(b[k] = malloc(BLOCKSIZE))) {
+			perror(names[k]);
+			return 1;
+		}
+		posix_fadvise(fd[k], 0, 0, POSIX_FADV_SEQUENTIAL);
+		size[k] = st.st_size;
+		if(!k || size[k] < min) min = size[k];
+		if(k && size[k] != size[0])
+			printf("sizes differ! %llu, %llu in %d\n", (long long) size[0], (long long) size[k], k);
+	}
+	for(pos = 0; pos < min; pos += BLOCKSIZE) {
+		size_t i = 0, n = min - pos < BLOCKSIZE ? min - pos : BLOCKSIZE;
+		uint64_t m = 0;
+		for(k = 0; k < nf; k++) if(readall(fd[k], b[k], n, pos) != n) {
+			perror(names[k]);
+			return 1;
+		}
+		/* e[k] is where copy k next starts or stops differing */
+		for(k = 1; k < nf; k++) {
+			if(b[0][0] != b[k][0]) m |= 1ULL << (k - 1);
+			e[k] = m >> (k - 1) & 1 ? differ(b[0], b[k], n) : same(b[0], b[k], n);
+		}
+		while(i < n) {
+			size_t t = n;
+			for(k = 1; k < nf; k++) if(e[k] < t) t = e[k];
+			multi_run(pos + i, t - i, m);
+			for(k = 1; t < n && k < nf; k++) if(e[k] == t) {
+				m ^= 1ULL << (k - 1);
+				e[k] = t + (m >> (k - 1) & 1 ? differ : same)(b[0] + t, b[k] + t, n - t);
+			}
+			i = t;
+		}
+	}
+	multi_flush();
+	for(k = 1; k < nf; k++) if(mbytes[k])
+		printf("%d %s: %llu bytes differ\n", k, names[k], (long long) mbytes[k]);
+	printf("%zu differences in %llu out of %llu bytes detected.\n",
+	        diffs, (long long) diffbytes, (long long) min);
+	return diffs != 0;
+}
 
 static void syntax(void) {
-	printf("syntax: filename1 filename2\nlist differences in binaries\n");
+	printf("syntax: [-j jobs] [-o patch | -s] [-b size] filename1 filename2\n"
+	       "        reference copy1 copy2 [copy3...]\n"
+	       "        [-j jobs] [-b size] --manifest manifest filename\n"
+	       "        [-j jobs] --against manifest filename\n"
+	       "list differences in binaries. with more than two files, list\n"
+	       "the ranges where copies, numbered from 1, differ from reference\n"
+	       "-j N: compare N ranges of the files in parallel, the default\n"
+	       "      for manifests is one per cpu\n"
+	       "-s: find data that was inserted, deleted or moved, by the\n"
+	       "    content of blocks of filename1 instead of their offset\n"
+	       "-b SIZE: the block size for -s (4096), --manifest (1M) and\n"
+	       "         --quick (64K)\n"
+	       "-o FILE: write a patch from filename1 to filename2 to FILE,\n"
+	       "         which bpatch applies. only for two files without\n"
+	       "         -s, --sync, --quick, --manifest or --against\n"
+	       "-S, --sync: write the differences into filename2, so it becomes\n"
+	       "            a copy of filename1\n"
+	       "--min-write SIZE: write at least SIZE aligned bytes with --sync,\n"
+	       "                  and join writes closer than that (4096)\n"
+	       "--fdatasync: flush filename2 to disk after --sync\n"
+	       "--quick: compare the size, whether the data is shared on disk,\n"
+	       "         and then only the first, the last and random blocks\n"
+	       "         until the first difference\n"
+	       "--samples N: the number of random blocks for --quick (1024)\n"
+	       "-m, --manifest FILE: write the hashes of the blocks of filename\n"
+	       "                     to FILE\n"
+	       "-a, --against FILE: list the blocks of filename that differ\n"
+	       "                    from the manifest FILE\n");
 	exit(1);
 }
 
@@ -58,10 +1264,77 @@ static int canread(char* fn) {
 }
 
 int main(int argc, char** argv) {
-	if(argc < 3) syntax();
-	if(!canread(argv[1]) || !canread(argv[2])) {
+	static const struct option opts[] = {
+		{"manifest", required_argument, 0, 'm'},
+		{"against", required_argument, 0, 'a'},
+		{"sync", no_argument, 0, 'S'},
+		{"min-write", required_argument, 0, 256},
+		{"fdatasync", no_argument, 0, 257},
+		{"quick", no_argument, 0, 258},
+		{"samples", required_argument, 0, 259},
+		{0},
+	};
+	const char *manifest = 0, *base = 0, *patchname = 0;
+	int c, njobs = 0, shift = 0, bs = 0, sync = 0, fast = 0;
+	while((c = getopt_long(argc, argv, "j:o:sb:m:a:S", opts, 0)) != -1) switch(c) {
+	case 'S': sync = 1; break;
+	case 256: if((syncmin = atoll(optarg)) < 1) syntax(); break;
+	case 257: datasync = 1; break;
+	case 258: fast = 1; break;
+	case 259: nsamples = strtoull(optarg, 0, 0); break;
+	case 's': shift = 1; break;
+	case 'b': if((bs = atoi(optarg)) < 1) syntax(); break;
+	case 'j': if((njobs = atoi(optarg)) < 1) njobs = 1; break;
+	case 'm': manifest = optarg; break;
+	case 'a': base = optarg; break;
+	case 'o': patchname = optarg; break;
+	default: syntax();
+	}
+	if(manifest || base) {
+		if(argc - optind < 1 || patchname) syntax();
+		if(!canread(argv[optind])) {
+			perror(argv[optind]);
+			return 1;
+		}
+		if(!njobs && (njobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1) njobs = 1;
+		if(manifest) return write_manifest(manifest, open(argv[optind], O_RDONLY), bs ? bs : BLOCKSIZE, njobs);
+		return against(base, open(argv[optind], O_RDONLY), njobs);
+	}
+	if(argc - optind < 2) syntax();
+	if(argc - optind > 2) {
+		if(shift || patchname || sync || fast) syntax();
+		return multi_diff(argc - optind, argv + optind);
+	}
+	if(!canread(argv[optind]) || !canread(argv[optind+1])) {
 		perror("can not read");
 		return 1;
 	}
-	return diff(fopen(argv[1], "r"), fopen(argv[2], "r"));
+	if(bs) shiftbs = bs;
+	if(!njobs) njobs = 1;
+	if(fast) {
+		if(shift || patchname || sync) syntax();
+		if(bs) quickbs = bs;
+		return quick(open(argv[optind], O_RDONLY), open(argv[optind+1], O_RDONLY), njobs);
+	}
+	if(sync) {
+		/* the patch would read the bytes already written */
+		if(shift || patchname) syntax();
+		syncname = argv[optind+1];
+		if((syncfd = open(syncname, O_RDWR)) == -1) {
+			perror(argv[optind+1]);
+			return 1;
+		}
+		return diff(open(argv[optind], O_RDONLY), syncfd, njobs);
+	}
+	if(shift) {
+		if(patchname) syntax();
+		return shift_diff(open(argv[optind], O_RDONLY), open(argv[optind+1], O_RDONLY));
+	}
+	/* opened only now, so a rejected command line leaves FILE alone */
+	if(patchname && !(patchf = fopen(patchname, "w"))) {
+		perror(patchname);
+		return 1;
+	}
+	return diff(open(argv[optind], O_RDONLY), open(argv[optind+1], O_RDONLY), njobs);
 }
+#endif
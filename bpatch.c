@@ -0,0 +1,196 @@
+#define BPATCH
+#include "bdiff.c"
+
+static int get_uleb(FILE *f, uint64_t *v) {
+	int c, sh = 0;
+	*v = 0;
+	do {
+		if((c = fgetc(f)) == EOF || sh > 63) return -1;
+		*v |= (uint64_t) (c & 0x7f) << sh;
+		sh += 7;
+	} while(c & 0x80);
+	return 0;
+}
+
+/* files are streamed through a block buffer, which is summed when it
+   is read or full */
+struct stream {
+	int fd;
+	off_t pos, size;
+	unsigned char *buf;
+	size_t n, i;
+	struct sum s;
+};
+
+static int out_flush(struct stream *o) {
+	size_t got = 0, n = o->n;
+	ssize_t r;
+	if(!n) return 0;
+	sum_set(&o->s, o->pos / BLOCKSIZE, o->buf, n);
+	while(got < n && (r = write(o->fd, o->buf + got, n - got)) > 0) got += r;
+	o->pos += n;
+	o->n = 0;
+	return got == n ? 0 : -1;
+}
+
+static int out_put(struct stream *o, const unsigned char *p, size_t n) {
+	while(n) {
+		size_t k = BLOCKSIZE - o->n < n ? BLOCKSIZE - o->n : n;
+		memcpy(o->buf + o->n, p, k);
+		o->n += k;
+		p += k;
+		n -= k;
+		if(o->n == BLOCKSIZE && out_flush(o)) return -1;
+	}
+	return 0;
+}
+
+/* takes n bytes of the source, passing them on to o if given */
+static int in_take(struct stream *in, off_t n, struct stream *o) {
+	while(n > 0) {
+		if(in->i == in->n) {
+			size_t want = in->size - in->pos < BLOCKSIZE ? in->size - in->pos : BLOCKSIZE;
+			if(!want || readall(in->fd, in->buf, want, in->pos) != want) return -1;
+			sum_set(&in->s, in->pos / BLOCKSIZE, in->buf, want);
+			in->pos += want;
+			in->n = want;
+			in->i = 0;
+		}
+		size_t k = in->n - in->i < n ? in->n - in->i : n;
+		if(o && out_put(o, in->buf + in->i, k)) return -1;
+		in->i += k;
+		n -= k;
+	}
+	return 0;
+}
+
+static off_t in_pos(struct stream *in) {
+	return in->pos - in->n + in->i;
+}
+
+static int stream_init(struct stream *s, int fd) {
+	struct stat st;
+	memset(s, 0, sizeof *s);
+	s->fd = fd;
+	s->buf = malloc(BLOCKSIZE);
+	if(fd == -1 || fstat(fd, &st)) return -1;
+	s->size = st.st_size;
+	return 0;
+}
+
+static int fail(const char *msg) {
+	dprintf(2, "%s\n", msg);
+	return 1;
+}
+
+/* applies the patch while copying the source to the target */
+static int copy(FILE *pf, int sfd, int tfd, uint64_t tsize, uint64_t ssum, uint64_t tsum) {
+	struct stream in, out;
+	uint64_t skip, len;
+	unsigned char *b = malloc(BLOCKSIZE);
+	if(stream_init(&in, sfd) || stream_init(&out, tfd)) return fail("can not open the files");
+	for(;;) {
+		if(get_uleb(pf, &skip) || get_uleb(pf, &len)) return fail("truncated patch");
+		if(!skip && !len) break;
+		if(in_take(&in, skip, &out)) return fail("patch does not fit the source");
+		/* the replaced bytes of the source are read for its sum */
+		skip = in.size - in_pos(&in) < len ? in.size - in_pos(&in) : len;
+		if(in_take(&in, skip, 0)) return fail("can not read the source");
+		while(len) {
+			size_t n = len < BLOCKSIZE ? len : BLOCKSIZE;
+			if(fread(b, 1, n, pf) != n) return fail("truncated patch");
+			if(out_put(&out, b, n)) return fail("can not write the target");
+			len -= n;
+		}
+	}
+	len = out.pos + out.n;
+	if(len > tsize || in_take(&in, tsize - len, &out)) return fail("patch does not fit the source");
+	if(in_take(&in, in.size - in_pos(&in), 0)) return fail("can not read the source");
+	if(out_flush(&out) || fsync(tfd)) return fail("can not write the target");
+	if(sum_get(&in.s) != ssum) return fail("the source does not match the patch");
+	if(sum_get(&out.s) != tsum) return fail("the target does not match the patch");
+	return 0;
+}
+
+static int sum_file(int fd, uint64_t *sum) {
+	struct stream in;
+	if(stream_init(&in, fd) || in_take(&in, in.size, 0)) return -1;
+	*sum = sum_get(&in.s);
+	return 0;
+}
+
+/* checks the source before changing it, and the result after */
+static int inplace(FILE *pf, int fd, uint64_t tsize, uint64_t ssum, uint64_t tsum) {
+	unsigned char *b = malloc(BLOCKSIZE);
+	uint64_t skip, len, sum;
+	off_t pos = 0;
+	if(sum_file(fd, &sum)) return fail("can not read the source");
+	if(sum != ssum) return fail("the source does not match the patch");
+	for(;;) {
+		if(get_uleb(pf, &skip) || get_uleb(pf, &len)) return fail("truncated patch, the file is damaged");
+		if(!skip && !len) break;
+		for(pos += skip; len; ) {
+			size_t n = len < BLOCKSIZE ? len : BLOCKSIZE;
+			if(fread(b, 1, n, pf) != n) return fail("truncated patch, the file is damaged");
+			if(pwrite(fd, b, n, pos) != n) return fail("can not write the file");
+			pos += n;
+			len -= n;
+		}
+	}
+	if(ftruncate(fd, tsize) || fsync(fd)) return fail("can not write the file");
+	if(sum_file(fd, &sum) || sum != tsum) return fail("the patched file does not match the patch");
+	return 0;
+}
+
+static void syntax(void) {
+	printf("syntax: [-o newfile] file patch\n"
+	       "apply a patch written by bdiff -o to file\n"
+	       "-o FILE: write the patched file to FILE instead of changing file\n");
+	exit(1);
+}
+
+int main(int argc, char** argv) {
+	unsigned char h[PATCHHEAD];
+	const char *out = 0;
+	FILE *pf;
+	int c, fd, r;
+	while((c = getopt(argc, argv, "o:")) != -1) switch(c) {
+	case 'o': out = optarg; break;
+	default: syntax();
+	}
+	if(argc - optind < 2) syntax();
+	if(!(pf = fopen(argv[optind+1], "r"))) {
+		perror(argv[optind+1]);
+		return 1;
+	}
+	if(fread(h, 1, sizeof h, pf) != sizeof h || memcmp(h, PATCHMAGIC, 8))
+		return fail("not a patch");
+	if((fd = open(argv[optind], out ? O_RDONLY : O_RDWR)) == -1) {
+		perror(argv[optind]);
+		return 1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size != get64(h + 8))
+		return fail("the source has the wrong size");
+	if(!out) return inplace(pf, fd, get64(h + 16), get64(h + 24), get64(h + 32));
+	/* the target is written next to out and only replaces it once it
+	   matches, so a failed patch leaves out, which may be the source,
+	   as it was */
+	char *tmp = malloc(strlen(out) + 8);
+	mode_t mask = umask(0);
+	umask(mask);
+	sprintf(tmp, "%s.XXXXXX", out);
+	int tfd = mkstemp(tmp);
+	if(tfd == -1 || fchmod(tfd, 0644 & ~mask)) {
+		perror(tmp);
+		if(tfd != -1) unlink(tmp);
+		return 1;
+	}
+	if((r = copy(pf, fd, tfd, get64(h + 16), get64(h + 24), get64(h + 32)))) unlink(tmp);
+	else if(rename(tmp, out)) {
+		perror(out);
+		unlink(tmp);
+		return 1;
+	}
+	return r;
+}
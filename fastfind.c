@@ -1,62 +1,2642 @@
 #define _ALL_SOURCE
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 
 #define BLOCKSIZE 64*1024
 #define ATIME 1
+#define CPINTERVAL 10
+#define SAMAXLEN 64
+#define MINPIECE 3
+#define IOPRIO_IDLE (3 << 13)
 
 static int usage(const char *a0) {
-	dprintf(2, "usage: %s file term\n"
-		   "search for term in file and print the offset if found\n\n"
+	dprintf(2, "usage: %s [options] file [term...]\n"
+		   "       %s index [options] file indexfile\n"
+		   "search for terms in file and print the offset of every hit, or\n"
+		   "build an index of the trigrams in every block of file\n\n"
+		   "-f FILE: read additional terms from FILE, one per line\n"
+		   "-x, --hex PATTERN: add a term given as hex bytes, e.g.\n"
+		   "                   'ffd8ff?? [2-4] 4a464946'. ?? and ? match any\n"
+		   "                   byte or nibble, [n-m] skips n to m bytes\n"
+		   "-i, --ignore-case: match ASCII letters of text terms in any case\n"
+		   "-e, --encoding LIST: search text terms encoded as each of the comma\n"
+		   "                     separated ascii, utf16le, utf16be, utf16, all\n"
+		   "-k, --mismatches N: also find terms with up to N bytes differing\n"
+		   "-m, --max-hits N: stop after N hits\n"
+		   "-1, --first: stop after the first hit\n"
+		   "-j, --jobs N: scan N ranges of the file in parallel\n"
+		   "-b, --block-size SIZE: read SIZE bytes at once (64K)\n"
+		   "-q, --queue-depth N: keep N reads in flight per job (4)\n"
+		   "-D, --direct: bypass the page cache with O_DIRECT\n"
+		   "-U, --no-uring: use a read-ahead thread instead of io_uring\n"
+		   "-K, --kernel NAME: use the avx512, avx2, sse2, scalar or memmem\n"
+		   "                   search kernel for a single term (best available)\n"
+		   "-B, --bench: print the throughput of each search kernel and exit\n"
+		   "-Z, --no-skip: search holes of sparse files and zero blocks too\n"
+		   "--max-rate MB: read at most MB megabytes per second\n"
+		   "--idle: read with the idle I/O priority class\n"
+		   "--drop-cache: drop the read data from the page cache, also\n"
+		   "              what was cached before\n"
+		   "--progress-fd FD: write the progress to FD instead of stderr\n"
+		   "--json: write the progress as JSON lines\n"
+		   "-c, --checkpoint FILE: save the progress and hits to FILE\n"
+		   "                       every %d seconds and when interrupted\n"
+		   "-r, --resume: continue the scan saved in the checkpoint FILE\n"
+		   "-C, --carve BEFORE:AFTER: write each hit with BEFORE bytes before\n"
+		   "                          and AFTER bytes after it to a file\n"
+		   "                          carve-OFFSET-TERM-ENCODING.bin. TERM\n"
+		   "                          counts the terms from 0, first those of\n"
+		   "                          -x and -f in the order of the options,\n"
+		   "                          then the terms after them\n"
+		   "-O, --carve-dir DIR: create the carved files in DIR\n"
+		   "-P, --partition N: only scan partition N of the MBR or GPT, can be\n"
+		   "                   given more than once\n"
+		   "-u, --unpartitioned: only scan the space outside of all partitions\n"
+		   "-L, --list-partitions: print the partitions of file and exit\n"
+		   "-F, --free: only scan the free blocks of the ext2/3/4 file system\n"
+		   "            in file or in each partition given with -P. the file\n"
+		   "            system must not be mounted\n"
+		   "-I, --index FILE: only read the blocks that can contain a term\n"
+		   "                  according to the index FILE\n"
+		   "--index-block SIZE: index blocks of SIZE bytes (64K)\n"
+		   "--filter-size SIZE: use SIZE bytes per block for the index\n"
+		   "                    (an 8th of the block size)\n"
+		   "                    a power of two, more makes queries read less\n"
+		   "running index again on an interrupted index continues it\n\n"
+		   "all terms are searched for in a single pass.\n"
 		   "optimized for big block reads\n"
 		   "designed to find strings of accidentally "
 		   "deleted files in blockdevices.\n"
-		, a0);
+		, a0, a0, CPINTERVAL);
 	return 1;
 }
 
-static off_t offset = 0;
-static int sigc, neednl;
-static void sigh(int nsig) {
-	sigc++;
-	dprintf(2, "\rcurrent offset: 0x%llx, elapsed %d", offset, sigc*ATIME);
-	alarm(ATIME);
-	neednl = 1;
+/* a term is a literal string, or a sequence of byte classes given
+   as bitmaps in cls if it was compiled from a hex pattern with
+   wildcards. s then holds the lowest byte of every class. text terms
+   are added once per encoding, and with icase set ASCII letters match
+   in either case; s is lowercase then. the gap variants of a hex
+   pattern share a group, in which a start offset is reported once.
+   term numbers the terms from 0 in the order they were added: those
+   of -x and -f as the options come, then the other arguments. */
+struct pattern {
+	const char *name, *enc;
+	unsigned char *s;
+	unsigned char (*cls)[32];
+	size_t len, group, term;
+	int icase;
+};
+
+static struct pattern *pats;
+static size_t npats, maxlen;
+
+enum { ENC_ASCII = 1, ENC_UTF16LE = 2, ENC_UTF16BE = 4 };
+static int icase, encodings, showenc, kerr;
+static const char **terms;
+static size_t nterms, *termno, ngiven;
+
+static void add_pattern(const char *name, const void *s, size_t len) {
+	if(!len) return;
+	pats = realloc(pats, (npats+1) * sizeof *pats);
+	pats[npats].name = name;
+	pats[npats].s = (void*) s;
+	pats[npats].cls = 0;
+	pats[npats].enc = "ascii";
+	pats[npats].icase = 0;
+	pats[npats].len = len;
+	pats[npats].group = npats;
+	npats++;
+	if(len > maxlen) maxlen = len;
+}
+
+static void add_term(const char *t) {
+	if(!*t) return;
+	terms = realloc(terms, (nterms+1) * sizeof *terms);
+	termno = realloc(termno, (nterms+1) * sizeof *termno);
+	termno[nterms] = ngiven++;
+	terms[nterms++] = t;
+}
+
+/* decodes the UTF-8 sequence at *p, bytes that are not valid UTF-8
+   are taken as latin-1 */
+static unsigned utf8_next(const unsigned char **p) {
+	const unsigned char *s = *p;
+	unsigned c = *s, n = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0, i;
+	if(c >= 0xf8 || (c >= 0x80 && c < 0xc0)) n = 0;
+	for(i = 1; i <= n; i++) if((s[i] & 0xc0) != 0x80) n = 0;
+	*p += n + 1;
+	if(!n) return c;
+	c &= 0x3f >> n;
+	for(i = 1; i <= n; i++) c = c << 6 | (s[i] & 0x3f);
+	return c;
+}
+
+static void add_utf16(const char *t, int be) {
+	const unsigned char *p = (const void*) t;
+	unsigned char *o = malloc(4 * strlen(t)), *q = o;
+	while(*p) {
+		unsigned c = utf8_next(&p), u[2], n = 1, i;
+		u[0] = c;
+		if(c >= 0x10000) {
+			c -= 0x10000;
+			u[0] = 0xd800 | c >> 10;
+			u[1] = 0xdc00 | (c & 0x3ff);
+			n = 2;
+		}
+		for(i = 0; i < n; i++) {
+			*q++ = be ? u[i] >> 8 : u[i] & 0xff;
+			*q++ = be ? u[i] & 0xff : u[i] >> 8;
+		}
+	}
+	add_pattern(t, o, q - o);
+	pats[npats-1].enc = be ? "utf16be" : "utf16le";
+}
+
+/* add the text terms in every requested encoding */
+static void expand_terms(void) {
+	size_t i, j, first = npats;
+	if(!encodings) encodings = ENC_ASCII;
+	for(i = 0; i < nterms; i++) {
+		size_t from = npats;
+		if(encodings & ENC_ASCII) add_pattern(terms[i], strdup(terms[i]), strlen(terms[i]));
+		if(encodings & ENC_UTF16LE) add_utf16(terms[i], 0);
+		if(encodings & ENC_UTF16BE) add_utf16(terms[i], 1);
+		for(j = from; j < npats; j++) pats[j].term = termno[i];
+	}
+	for(i = first; icase && i < npats; i++) {
+		pats[i].icase = 1;
+		for(j = 0; j < pats[i].len; j++)
+			if(pats[i].s[j] >= 'A' && pats[i].s[j] <= 'Z') pats[i].s[j] += 32;
+	}
+	showenc = encodings != ENC_ASCII;
+}
+
+static int parse_encodings(char *s) {
+	char *t;
+	for(t = strtok(s, ","); t; t = strtok(0, ",")) {
+		if(!strcmp(t, "ascii")) encodings |= ENC_ASCII;
+		else if(!strcmp(t, "utf16le")) encodings |= ENC_UTF16LE;
+		else if(!strcmp(t, "utf16be")) encodings |= ENC_UTF16BE;
+		else if(!strcmp(t, "utf16")) encodings |= ENC_UTF16LE|ENC_UTF16BE;
+		else if(!strcmp(t, "all")) encodings |= ENC_ASCII|ENC_UTF16LE|ENC_UTF16BE;
+		else return -1;
+	}
+	return 0;
+}
+
+static int read_patterns(const char *fn) {
+	FILE *f = fopen(fn, "r");
+	char *line = 0;
+	size_t cap = 0;
+	ssize_t l;
+	if(!f) {
+		perror(fn);
+		return -1;
+	}
+	while((l = getline(&line, &cap, f)) > 0) {
+		if(line[l-1] == '\n') line[--l] = 0;
+		if(l && line[l-1] == '\r') line[--l] = 0;
+		if(l) add_term(strdup(line));
+	}
+	free(line);
+	fclose(f);
+	return 0;
+}
+
+/* aho-corasick automaton with a full 256-way transition table.
+   out[s] is the first of the patterns ending in state s, or -1, and
+   dict[s] the next state along the suffix links that has an output. */
+static struct ac {
+	int *go, *fail, *out, *dict;
+	int nstates, nstart;
+	unsigned char start[4];
+} ac;
+
+static void ac_build(struct ac *a, const struct pattern *p, size_t np) {
+	size_t i, j, total = 1;
+	int s, c, *queue, qh = 0, qt = 0;
+	for(i = 0; i < np; i++) total += p[i].len;
+	a->go = malloc(total * 256 * sizeof(int));
+	a->fail = calloc(total, sizeof(int));
+	a->out = malloc(total * sizeof(int));
+	a->dict = malloc(total * sizeof(int));
+	queue = malloc(total * sizeof(int));
+	memset(a->go, -1, 256 * sizeof(int));
+	a->out[0] = a->dict[0] = -1;
+	a->nstates = 1;
+	for(i = 0; i < np; i++) {
+		for(s = 0, j = 0; j < p[i].len; j++) {
+			c = p[i].s[j];
+			if(a->go[s*256+c] == -1) {
+				int n = a->nstates++;
+				memset(a->go + n*256, -1, 256 * sizeof(int));
+				a->out[n] = a->dict[n] = -1;
+				a->go[s*256+c] = n;
+			}
+			s = a->go[s*256+c];
+		}
+		if(a->out[s] == -1) a->out[s] = i;
+	}
+	for(c = 0; c < 256; c++) {
+		int n = a->go[c];
+		if(n == -1) a->go[c] = 0;
+		else queue[qt++] = n;
+	}
+	while(qh < qt) {
+		s = queue[qh++];
+		int f = a->fail[s];
+		a->dict[s] = a->out[f] != -1 ? f : a->dict[f];
+		for(c = 0; c < 256; c++) {
+			int n = a->go[s*256+c];
+			if(n == -1) a->go[s*256+c] = a->go[f*256+c];
+			else {
+				a->fail[n] = a->go[f*256+c];
+				queue[qt++] = n;
+			}
+		}
+	}
+	free(queue);
+	/* icase terms are stored in lowercase, so uppercase input takes
+	   the same transitions as lowercase. */
+	for(i = 0; i < np && p[i].icase; i++);
+	if(i == np) for(s = 0; s < a->nstates; s++)
+		for(c = 'A'; c <= 'Z'; c++) a->go[s*256+c] = a->go[s*256+c+32];
+	/* with few distinct first bytes, the search skips ahead to the
+	   next one of them with vector compares while in the root state. */
+	for(c = 0; c < 256; c++) if(a->go[c]) {
+		if(a->nstart == sizeof a->start) {
+			a->nstart = 0;
+			break;
+		}
+		a->start[a->nstart++] = c;
+	}
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* index of the first byte in p[i..n) that is one of the start bytes */
+static size_t ac_skip(const struct ac *a, const unsigned char *p, size_t i, size_t n) {
+#ifdef __SSE2__
+	__m128i v[4], z = _mm_setzero_si128();
+	int k;
+	for(k = 0; k < 4; k++) v[k] = _mm_set1_epi8(a->start[k < a->nstart ? k : 0]);
+	for(; i + 16 <= n; i += 16) {
+		__m128i b = _mm_loadu_si128((const void*)(p + i)), m = z;
+		for(k = 0; k < a->nstart; k++) m = _mm_or_si128(m, _mm_cmpeq_epi8(b, v[k]));
+		unsigned mask = _mm_movemask_epi8(m);
+		if(mask) return i + __builtin_ctz(mask);
+	}
+#endif
+	for(; i < n; i++) if(a->go[p[i]]) break;
+	return i;
+}
+
+#define MAXVARIANTS 1024
+#define CLS_SET(c, b) ((c)[(b)>>3] |= 1 << ((b)&7))
+#define CLS_HAS(c, b) ((c)[(b)>>3] & 1 << ((b)&7))
+
+static int hexval(int c) {
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return c == '?' ? 16 : -1;
+}
+
+static void add_class_pattern(const char *name, unsigned char (*cls)[32], size_t len) {
+	unsigned char *s = malloc(len);
+	size_t i, b, n, literal = 1;
+	for(i = 0; i < len; i++) {
+		for(n = 0, b = 256; b--; ) if(CLS_HAS(cls[i], b)) s[i] = b, n++;
+		if(n != 1) literal = 0;
+	}
+	add_pattern(name, s, len);
+	pats[npats-1].enc = "hex";
+	if(literal) return;
+	pats[npats-1].cls = malloc(len * sizeof *cls);
+	memcpy(pats[npats-1].cls, cls, len * sizeof *cls);
+}
+
+/* hex pattern syntax: pairs of hex digits, where either digit may be
+   ? to match any value of that nibble, and [n] or [n-m] for a gap of
+   n or n to m arbitrary bytes. whitespace is ignored. a pattern with
+   gaps is added once for every possible gap length. */
+static int parse_hex(const char *hex) {
+	struct { int cls, lo, hi; } *el = malloc(strlen(hex) * sizeof *el);
+	unsigned char (*cls)[32] = malloc(strlen(hex) / 2 * sizeof *cls), (*v)[32] = 0;
+	size_t nel = 0, ncls = 0, variants = 1, maxv = 0, i, k, len;
+	const char *p = hex;
+	while(*p) {
+		if(*p == ' ' || *p == '\t') { p++; continue; }
+		if(*p == '[') {
+			char *e;
+			el[nel].cls = -1;
+			el[nel].lo = el[nel].hi = strtol(p + 1, &e, 10);
+			if(*e == '-') el[nel].hi = strtol(e + 1, &e, 10);
+			if(*e != ']' || el[nel].lo < 0 || el[nel].hi < el[nel].lo || el[nel].hi > BLOCKSIZE)
+				goto bad;
+			variants *= el[nel].hi - el[nel].lo + 1;
+			maxv += el[nel].hi;
+			p = e + 1;
+		} else {
+			int h = hexval(p[0]), l = h == -1 ? -1 : hexval(p[1]), b;
+			if(h == -1 || l == -1) goto bad;
+			memset(cls[ncls], 0, 32);
+			for(b = 0; b < 256; b++)
+				if((h == 16 || b >> 4 == h) && (l == 16 || (b & 15) == l))
+					CLS_SET(cls[ncls], b);
+			el[nel].cls = ncls++;
+			maxv++;
+			p += 2;
+		}
+		if(variants > MAXVARIANTS) goto bad;
+		nel++;
+	}
+	if(!ncls) goto bad;
+	v = malloc(maxv * sizeof *v);
+	size_t group = npats, term = ngiven++;
+	for(k = 0; k < variants; k++) {
+		size_t sel = k;
+		for(len = i = 0; i < nel; i++) {
+			int n = el[i].cls == -1 ? el[i].lo : 1;
+			if(el[i].cls == -1) {
+				n += sel % (el[i].hi - el[i].lo + 1);
+				sel /= el[i].hi - el[i].lo + 1;
+			}
+			while(n--) {
+				if(el[i].cls == -1) memset(v[len++], 0xff, 32);
+				else memcpy(v[len++], cls[el[i].cls], 32);
+			}
+		}
+		add_class_pattern(hex, v, len);
+		pats[npats-1].group = group;
+		pats[npats-1].term = term;
+	}
+	free(v);
+	free(el);
+	free(cls);
+	return 0;
+bad:
+	dprintf(2, "invalid hex pattern (at most %d gap variants): %s\n", MAXVARIANTS, hex);
+	free(el);
+	free(cls);
+	return -1;
+}
+
+/* shift-and matcher for terms with byte classes. the terms are packed
+   into 64 bit words, each term taking one bit per byte; init has the
+   bit of the first byte of every term set, fin that of the last. */
+static struct saword {
+	uint64_t b[256], init, fin;
+	int pat[64];
+} *saw;
+static size_t nsaw;
+
+/* k mismatches: of k+1 disjoint pieces of a term, one is found
+   without a mismatch wherever the term matches. the pieces are found
+   with an automaton of their own and the term is only compared there.
+   terms without k+1 pieces of plain bytes use the shift-and matcher.
+   without mismatches, the piece of a term with wildcards is its
+   longest run of plain bytes, if it has one of MINPIECE bytes. */
+static struct pattern *pieces;
+static size_t npieces, *piecepat, *pieceoff;
+static int *piecenext, piecefind;
+static char *filtered;
+static struct ac pac;
+
+/* whether byte j of p matches only one byte, or one letter in both
+   cases when the automaton folds case */
+static int plain(const struct pattern *p, size_t j, int fold) {
+	int n = 0, b;
+	if(p->cls) {
+		for(b = 0; b < 256; b++) if(CLS_HAS(p->cls[j], b)) n++;
+		return n == 1;
+	}
+	return !p->icase || fold || p->s[j] < 'a' || p->s[j] > 'z';
+}
+
+static void add_piece(size_t pat, size_t off, size_t len) {
+	if(!(npieces & 63)) {
+		pieces = realloc(pieces, (npieces + 64) * sizeof *pieces);
+		piecepat = realloc(piecepat, (npieces + 64) * sizeof *piecepat);
+		pieceoff = realloc(pieceoff, (npieces + 64) * sizeof *pieceoff);
+	}
+	pieces[npieces] = pats[pat];
+	pieces[npieces].s = pats[pat].s + off;
+	pieces[npieces].cls = 0;
+	pieces[npieces].len = len;
+	piecepat[npieces] = pat;
+	pieceoff[npieces++] = off;
+}
+
+/* the pieces are as long as possible, cut from the runs of plain bytes */
+static void piece_build(void) {
+	size_t i, j, l, run, n, first;
+	int fold = 1, s;
+	for(i = 0; i < npats; i++) if(!pats[i].icase) fold = 0;
+	filtered = calloc(npats, 1);
+	for(i = 0; i < npats; i++) {
+		for(l = pats[i].len / (kerr + 1); l; l--) {
+			for(n = run = j = 0; j < pats[i].len; j++) {
+				run = plain(&pats[i], j, fold) ? run + 1 : 0;
+				if(run == l) {
+					n++;
+					run = 0;
+				}
+			}
+			if(n > (size_t) kerr) break;
+		}
+		if(!l || (!kerr && l < MINPIECE)) continue;
+		first = npieces;
+		for(run = j = 0; j < pats[i].len && npieces - first <= (size_t) kerr; j++) {
+			run = plain(&pats[i], j, fold) ? run + 1 : 0;
+			if(run == l) {
+				add_piece(i, j + 1 - l, l);
+				run = 0;
+			}
+		}
+		filtered[i] = 1;
+	}
+	if(!npieces) return;
+	for(i = 0; i < npieces && !pieces[i].icase; i++);
+	if((piecefind = i == npieces && npieces <= 8)) return;
+	ac_build(&pac, pieces, npieces);
+	/* equal pieces end in the same state, which has only one output */
+	piecenext = malloc(npieces * sizeof *piecenext);
+	for(i = 0; i < npieces; i++) piecenext[i] = -1;
+	for(i = 0; i < npieces; i++) {
+		for(s = 0, j = 0; j < pieces[i].len; j++) s = pac.go[s*256+pieces[i].s[j]];
+		if(pac.out[s] != (int) i) {
+			piecenext[i] = piecenext[pac.out[s]];
+			piecenext[pac.out[s]] = i;
+		}
+	}
+}
+
+static void sa_build(void) {
+	size_t i, j, bit = 64;
+	int c;
+	for(i = 0; i < npats; i++) {
+		if(filtered && filtered[i]) continue;
+		if(bit + pats[i].len > 64) {
+			saw = realloc(saw, ++nsaw * sizeof *saw);
+			memset(&saw[nsaw-1], 0, sizeof *saw);
+			bit = 0;
+		}
+		struct saword *w = &saw[nsaw-1];
+		w->init |= 1ULL << bit;
+		for(j = 0; j < pats[i].len; j++, bit++)
+			for(c = 0; c < 256; c++)
+				if(pats[i].cls ? CLS_HAS(pats[i].cls[j], c) : pats[i].s[j] == c ||
+				   (pats[i].icase && c >= 'A' && c <= 'Z' && pats[i].s[j] == c + 32))
+					w->b[c] |= 1ULL << bit;
+		w->fin |= 1ULL << (bit - 1);
+		w->pat[bit - 1] = i;
+	}
+}
+
+/* single term search kernels. the vector versions compare the first
+   and the last byte of the term at every position of a whole vector
+   at once and only check the candidates where both match. */
+typedef const unsigned char *findfn(const unsigned char *h, size_t n, const unsigned char *nd, size_t m);
+
+static const unsigned char *find_scalar(const unsigned char *h, size_t n, const unsigned char *nd, size_t m) {
+	const unsigned char *p = h, *e = h + n - m + 1;
+	if(m > n) return 0;
+	while((p = memchr(p, nd[0], e - p))) {
+		if(p[m-1] == nd[m-1] && !memcmp(p + 1, nd + 1, m - 1)) return p;
+		p++;
+	}
+	return 0;
+}
+
+static const unsigned char *find_memmem(const unsigned char *h, size_t n, const unsigned char *nd, size_t m) {
+	return memmem(h, n, nd, m);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define FIND_VEC(NAME, TARGET, VT, W, SET1, LOAD, MATCH) \
+__attribute__((target(TARGET))) \
+static const unsigned char *NAME(const unsigned char *h, size_t n, const unsigned char *nd, size_t m) { \
+	size_t i = 0; \
+	if(m < 2 || m > n) return find_scalar(h, n, nd, m); \
+	VT first = SET1(nd[0]), last = SET1(nd[m-1]); \
+	for(; i + m - 1 + W <= n; i += W) { \
+		VT bf = LOAD((const void*)(h + i)), bl = LOAD((const void*)(h + i + m - 1)); \
+		uint64_t mask = MATCH; \
+		while(mask) { \
+			unsigned bit = __builtin_ctzll(mask); \
+			if(!memcmp(h + i + bit + 1, nd + 1, m - 2)) return h + i + bit; \
+			mask &= mask - 1; \
+		} \
+	} \
+	return find_scalar(h + i, n - i, nd, m); \
+}
+
+FIND_VEC(find_sse2, "sse2", __m128i, 16, _mm_set1_epi8, _mm_loadu_si128,
+	(unsigned) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl))))
+FIND_VEC(find_avx2, "avx2", __m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256,
+	(unsigned) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl))))
+FIND_VEC(find_avx512, "avx512f,avx512bw", __m512i, 64, _mm512_set1_epi8, _mm512_loadu_si512,
+	_mm512_cmpeq_epi8_mask(first, bf) & _mm512_cmpeq_epi8_mask(last, bl))
+#endif
+
+static const struct kernel {
+	const char *name;
+	findfn *fn;
+	const char *cpu;
+} kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{"avx512", find_avx512, "avx512bw"},
+	{"avx2", find_avx2, "avx2"},
+	{"sse2", find_sse2, "sse2"},
+#endif
+	{"scalar", find_scalar, 0},
+	{"memmem", find_memmem, 0},
+};
+
+static int kernel_ok(const struct kernel *k) {
+	if(!k->cpu) return 1;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(!strcmp(k->cpu, "avx512bw")) return __builtin_cpu_supports("avx512bw");
+	if(!strcmp(k->cpu, "avx2")) return __builtin_cpu_supports("avx2");
+	if(!strcmp(k->cpu, "sse2")) return __builtin_cpu_supports("sse2");
+#endif
+	return 0;
+}
+
+/* the best kernel this cpu supports, or the one called name */
+static findfn *find_kernel(const char *name) {
+	size_t i;
+	for(i = 0; i < sizeof kernels / sizeof *kernels; i++)
+		if((!name || !strcmp(name, kernels[i].name)) && kernel_ok(&kernels[i]))
+			return kernels[i].fn;
+	return 0;
+}
+
+static findfn *find = find_scalar;
+
+/* search a buffer without any hits with every kernel and print the throughput */
+static int bench(void) {
+	size_t i, n = 256 << 20, r;
+	unsigned char *buf = malloc(n);
+	static const unsigned char nd[] = "qzxvjkwpyfmbgthd";
+	uint32_t x = 1;
+	for(i = 0; i < n; i++) {
+		x = x * 1103515245 + 12345;
+		buf[i] = 'a' + (x >> 16) % 26;
+	}
+	for(i = 0; i < sizeof kernels / sizeof *kernels; i++) {
+		struct timespec t0, t1;
+		double secs;
+		if(!kernel_ok(&kernels[i])) {
+			dprintf(1, "%-8s unsupported\n", kernels[i].name);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for(r = 0; r < 4; r++)
+			if(kernels[i].fn(buf, n, nd, sizeof nd - 1)) abort();
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		dprintf(1, "%-8s %6.2f GB/s\n", kernels[i].name, 4.0 * n / secs / 1e9);
+	}
+	free(buf);
+	return 0;
+}
+
+struct hit {
+	off_t off, end;
+	size_t pat;
+	int mism;
+};
+
+struct carve {
+	int fd;
+	off_t next, end;
+};
+
+/* the carver of a worker keeps the last bytes before the current block
+   in a ring, so the context before a hit is at hand, and a list of
+   output files that still want the context after their hit. */
+struct carver {
+	unsigned char *ring;
+	size_t rsize, rlen, rhead;
+	off_t rend;
+	struct carve *pend;
+	size_t npend;
+	struct hit *newh;
+	size_t nnew, cap;
+};
+
+/* a byte range to scan. cont is set if it continues the data before
+   it, so the overlap has to be read from there. */
+struct range {
+	off_t start, end;
+	int cont;
+};
+
+/* each worker scans its list of byte ranges on its own thread. start
+   and end are the first and last offset of all of them. its hits are
+   printed directly while all workers before it are done, and buffered
+   until then otherwise, so output is in offset order. */
+struct worker {
+	pthread_t t;
+	int id;
+	struct range *rg;
+	size_t nrg;
+	off_t start, end, pos, scanned, skipped;
+	struct hit *hits, *kh;
+	size_t nhits, cap, nkh, kcap;
+	int done, probe;
+	struct carver cv;
+};
+
+static struct worker *workers;
+static int nworkers = 1, head, fd;
+static volatile int stop;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int neednl;
+static double maxrate;
+static unsigned long long tbwaits, tbwaitus, found;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the progress is printed by a thread every ATIME seconds, as a line
+   on stderr that is overwritten or as JSON lines to progfd */
+static int progfd = 2, progjson;
+static off_t fsize = -1, total;
+static pthread_t progt;
+static pthread_mutex_t pmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pcond = PTHREAD_COND_INITIALIZER;
+static int pquit;
+
+static void progress(double start, double *lastt, off_t *last, int end) {
+	off_t done = 0, skipped = 0;
+	double t = now(), el = t - start, rate, avg;
+	unsigned long long us = __atomic_load_n(&tbwaitus, __ATOMIC_RELAXED);
+	unsigned long long nw = __atomic_load_n(&tbwaits, __ATOMIC_RELAXED);
+	unsigned long long nh = __atomic_load_n(&found, __ATOMIC_RELAXED);
+	char line[1024];
+	int i, l, eta = -1;
+	for(i = 0; i < nworkers; i++) {
+		done += __atomic_load_n(&workers[i].scanned, __ATOMIC_RELAXED);
+		skipped += __atomic_load_n(&workers[i].skipped, __ATOMIC_RELAXED);
+	}
+	rate = t > *lastt ? (done - *last) / (t - *lastt) : 0;
+	avg = el > 0 ? done / el : 0;
+	if(total > 0 && avg > 0) eta = (total - done) / avg;
+	*lastt = t;
+	*last = done;
+	if(progjson) {
+		l = snprintf(line, sizeof line, "{\"elapsed\":%.1f,\"size\":%lld,\"total\":%lld,"
+			"\"scanned\":%lld,\"searched\":%lld,\"skipped\":%lld,\"rate\":%.0f,"
+			"\"avg_rate\":%.0f,\"eta\":%d,\"hits\":%llu,\"throttle_waits\":%llu,"
+			"\"throttled\":%.1f,\"done\":%s}\n",
+			el, (long long) fsize, (long long) total, (long long) done,
+			(long long) (done - skipped), (long long) skipped, rate, avg, eta,
+			nh, nw, us / 1e6, end ? "true" : "false");
+		write(progfd, line, l);
+		return;
+	}
+	if(end) return;
+	if(nworkers == 1)
+		l = snprintf(line, sizeof line, "\rcurrent offset: 0x%llx", (unsigned long long) workers[0].pos);
+	else
+		l = snprintf(line, sizeof line, "\rscanned: 0x%llx", (unsigned long long) done);
+	if(total > 0)
+		l += snprintf(line + l, sizeof line - l, " of 0x%llx (%d%%)",
+			(unsigned long long) total, (int) (done * 100 / total));
+	l += snprintf(line + l, sizeof line - l, ", elapsed %d, %llu MB/s, avg %llu MB/s",
+		(int) el, (unsigned long long) rate >> 20, (unsigned long long) avg >> 20);
+	if(skipped)
+		l += snprintf(line + l, sizeof line - l, ", searched %llu MB, skipped %llu MB",
+			(unsigned long long) (done - skipped) >> 20,
+			(unsigned long long) skipped >> 20);
+	l += snprintf(line + l, sizeof line - l, ", hits %llu", nh);
+	if(eta >= 0)
+		l += snprintf(line + l, sizeof line - l, ", eta %d:%02d:%02d", eta / 3600, eta / 60 % 60, eta % 60);
+	if(maxrate)
+		l += snprintf(line + l, sizeof line - l, ", throttled %llu.%llus in %llu waits",
+			us / 1000000, us / 100000 % 10, nw);
+	if(progfd != 2) line[l++] = '\n';
+	write(progfd, line + (progfd != 2), l - (progfd != 2));
+	if(progfd == 2) neednl = 1;
+}
+
+static void *progress_thread(void *arg) {
+	double start = now(), lastt = start;
+	off_t last = 0;
+	struct timespec ts;
+	pthread_mutex_lock(&pmtx);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	while(!pquit) {
+		ts.tv_sec += ATIME;
+		while(!pquit && !pthread_cond_timedwait(&pcond, &pmtx, &ts));
+		if(!pquit) progress(start, &lastt, &last, 0);
+	}
+	progress(start, &lastt, &last, 1);
+	pthread_mutex_unlock(&pmtx);
+	return 0;
+}
+
+/* the bytes to read are the ranges of all workers */
+static void progress_start(void) {
+	int i;
+	size_t j;
+	for(i = 0; i < nworkers; i++) for(j = 0; j < workers[i].nrg; j++)
+		total = workers[i].rg[j].end == -1 ? -1 : total + workers[i].rg[j].end - workers[i].rg[j].start;
+	if(total < 0) total = 0;
+	pthread_create(&progt, 0, progress_thread, 0);
+}
+
+static void progress_stop(void) {
+	pthread_mutex_lock(&pmtx);
+	pquit = 1;
+	pthread_cond_signal(&pcond);
+	pthread_mutex_unlock(&pmtx);
+	pthread_join(progt, 0);
+}
+
+static unsigned long long hits, maxhits;
+
+/* all printed hits, kept for the checkpoint */
+static struct hit *printed;
+static size_t nprinted;
+static const char *cpfile;
+
+/* partitions from the MBR or GPT at the start of the file */
+struct part {
+	int num;
+	off_t start, end;
+	char type[64];
+};
+static struct part *parts;
+static int nparts, *selparts, nselparts, unpart, listparts;
+
+static void emit_hit(const struct hit *h) {
+	if(cpfile) {
+		if(!(nprinted & (nprinted + 1)))
+			printed = realloc(printed, (2 * nprinted + 1) * sizeof *printed);
+		printed[nprinted++] = *h;
+	}
+	char line[4096];
+	int i, l = snprintf(line, sizeof line, "bingo: 0x%llx", (unsigned long long) h->off);
+	if(npats > 1 || showenc)
+		l += snprintf(line + l, sizeof line - l, " %s", pats[h->pat].name);
+	if(showenc)
+		l += snprintf(line + l, sizeof line - l, " %s", pats[h->pat].enc);
+	if(kerr)
+		l += snprintf(line + l, sizeof line - l, " mismatches=%d", h->mism);
+	for(i = 0; i < nparts; i++) if(h->off >= parts[i].start && h->off < parts[i].end)
+		l += snprintf(line + l, sizeof line - l, " partition %d+0x%llx", parts[i].num,
+			(unsigned long long) (h->off - parts[i].start));
+	if(neednl) dprintf(2, "\n");
+	neednl = 0;
+	dprintf(1, "%s\n", line);
+	if(++hits == maxhits) stop = 1;
+}
+
+/* hits arrive in the order of their end, but are printed in the order
+   of their start. a hit is held back until no hit found later can
+   start before it, which is once everything up to maxlen bytes past
+   its start was searched. */
+static struct hit *held;
+static size_t nheld, heldcap;
+
+/* everything up to pos was searched */
+static void release(off_t pos) {
+	size_t i;
+	for(i = 0; i < nheld && held[i].off + (off_t) maxlen <= pos; i++)
+		if(!maxhits || hits < maxhits) emit_hit(&held[i]);
+	memmove(held, held + i, (nheld -= i) * sizeof *held);
+}
+
+static void print_hit(const struct hit *h) {
+	size_t i;
+	/* of the variants of a pattern starting here, the one with the
+	   fewest mismatches is kept */
+	for(i = nheld; i && held[i-1].off >= h->off; i--) {
+		if(held[i-1].off != h->off || pats[held[i-1].pat].group != pats[h->pat].group) continue;
+		if(held[i-1].mism <= h->mism) return;
+		memmove(held + i - 1, held + i, (--nheld - i + 1) * sizeof *held);
+		break;
+	}
+	if(nheld == heldcap) {
+		heldcap = heldcap ? heldcap * 2 : 64;
+		held = realloc(held, heldcap * sizeof *held);
+	}
+	for(i = nheld; i && (held[i-1].off > h->off || (held[i-1].off == h->off && held[i-1].end > h->end)); i--)
+		held[i] = held[i-1];
+	held[i] = *h;
+	nheld++;
+	release(h->end - 1);
+}
+
+static void add_hit(struct worker *w, const struct hit *h) {
+	size_t i;
+	/* the same as in print_hit(), among the hits that end after h starts */
+	for(i = w->nhits; i && w->hits[i-1].end > h->off; i--) {
+		if(w->hits[i-1].off != h->off || pats[w->hits[i-1].pat].group != pats[h->pat].group) continue;
+		if(w->hits[i-1].mism <= h->mism) return;
+		memmove(w->hits + i - 1, w->hits + i, (--w->nhits - i + 1) * sizeof *w->hits);
+		break;
+	}
+	if(w->nhits == w->cap) {
+		w->cap = w->cap ? w->cap * 2 : 64;
+		w->hits = realloc(w->hits, w->cap * sizeof *w->hits);
+	}
+	w->hits[w->nhits++] = *h;
+}
+
+static int carving;
+static size_t carve_before, carve_after;
+static const char *carve_dir = ".";
+
+/* returns nonzero once the worker should stop scanning */
+static int report(struct worker *w, off_t off, off_t end, size_t pat, int mism) {
+	struct hit h = {.off = off, .end = end, .pat = pat, .mism = mism};
+	if(w->probe) return ++w->nhits;
+	pthread_mutex_lock(&lock);
+	int keep = !stop;
+	if(keep) __atomic_add_fetch(&found, 1, __ATOMIC_RELAXED);
+	if(stop) ;
+	else if(w->id == head) print_hit(&h);
+	else add_hit(w, &h);
+	if(keep && carving) {
+		struct carver *cv = &w->cv;
+		if(cv->nnew == cv->cap) {
+			cv->cap = cv->cap ? cv->cap * 2 : 16;
+			cv->newh = realloc(cv->newh, cv->cap * sizeof *cv->newh);
+		}
+		cv->newh[cv->nnew++] = h;
+	}
+	pthread_mutex_unlock(&lock);
+	/* a worker never needs more hits than could be printed */
+	return stop || (maxhits && w->nhits >= maxhits);
+}
+
+static pthread_cond_t donecond = PTHREAD_COND_INITIALIZER;
+static int ndone;
+
+static void finish(struct worker *w) {
+	size_t i;
+	pthread_mutex_lock(&lock);
+	w->done = 1;
+	ndone++;
+	pthread_cond_signal(&donecond);
+	while(!stop && workers[head].done && head + 1 < nworkers) {
+		w = &workers[++head];
+		for(i = 0; i < w->nhits && !stop; i++) print_hit(&w->hits[i]);
+		free(w->hits);
+		w->hits = 0;
+		w->nhits = 0;
+	}
+	if(workers[head].done && workers[head].end != -1) release(workers[head].end);
+	pthread_mutex_unlock(&lock);
+}
+
+/* the mismatches of p at b, up to kerr+1 */
+static int mismatches(const struct pattern *p, const unsigned char *b) {
+	size_t j;
+	int n = 0;
+	for(j = 0; j < p->len && n <= kerr; j++)
+		if(!(p->cls ? CLS_HAS(p->cls[j], b[j]) : p->s[j] == b[j] ||
+		     (p->icase && b[j] >= 'A' && b[j] <= 'Z' && p->s[j] == b[j] + 32)))
+			n++;
+	return n;
+}
+
+/* with mismatches, the hits of a block are found out of order and
+   collected first */
+static void kadd(struct worker *w, off_t off, off_t end, size_t pat, int mism) {
+	if(w->nkh == w->kcap) {
+		w->kcap = w->kcap ? w->kcap * 2 : 64;
+		w->kh = realloc(w->kh, w->kcap * sizeof *w->kh);
+	}
+	w->kh[w->nkh++] = (struct hit) {.off = off, .end = end, .pat = pat, .mism = mism};
+}
+
+/* piece q was found at buf[at] */
+static void piece_hit(struct worker *w, const unsigned char *buf, size_t ctx, size_t len, off_t base, int q, size_t at) {
+	size_t p = piecepat[q];
+	int j;
+	if(at < pieceoff[q] || (at -= pieceoff[q]) + pats[p].len > len || at + pats[p].len <= ctx) return;
+	if((j = mismatches(&pats[p], buf + at)) <= kerr) kadd(w, base + at, base + at + pats[p].len, p, j);
+}
+
+static int kh_cmp(const void *a, const void *b) {
+	const struct hit *x = a, *y = b;
+	if(x->end != y->end) return x->end < y->end ? -1 : 1;
+	return x->pat < y->pat ? -1 : x->pat > y->pat;
+}
+
+/* report every hit in buf that ends past the first ctx bytes.
+   buf starts at file offset base, and the ctx bytes are the tail of
+   the previous block, at most maxlen-1 long, so a hit that was
+   already reported can never end past them. */
+/* the shift-and matcher without mismatches. with collect set, the
+   hits are collected with those around the pieces */
+static int sa_search(struct worker *w, const unsigned char *buf, size_t ctx, size_t len, off_t base, int collect) {
+	uint64_t d[nsaw], m;
+	size_t i, k;
+	memset(d, 0, sizeof d);
+	for(i = 0; i < len; i++) for(k = 0; k < nsaw; k++) {
+		d[k] = ((d[k] << 1) | saw[k].init) & saw[k].b[buf[i]];
+		if(!(m = d[k] & saw[k].fin) || i < ctx) continue;
+		for(; m; m &= m - 1) {
+			int p = saw[k].pat[__builtin_ctzll(m)];
+			if(collect) kadd(w, base + i + 1 - pats[p].len, base + i + 1, p, 0);
+			else if(report(w, base + i + 1 - pats[p].len, base + i + 1, p, 0)) return 1;
+		}
+	}
+	return 0;
+}
+
+static int search(struct worker *w, const unsigned char *buf, size_t ctx, size_t len, off_t base) {
+	size_t i, k;
+	if(kerr || npieces) {
+		/* d[k][j] has the bits of the term prefixes that match the
+		   input ending here with at most j mismatches */
+		uint64_t d[nsaw + 1][kerr+1], m, prev, cur;
+		int j, s = 0, o, q;
+		memset(d, 0, sizeof d);
+		w->nkh = 0;
+		if(!kerr && nsaw) sa_search(w, buf, ctx, len, base, 1);
+		for(i = 0; kerr && nsaw && i < len; i++) for(k = 0; k < nsaw; k++) {
+			uint64_t b = saw[k].b[buf[i]], init = saw[k].init;
+			prev = d[k][0];
+			d[k][0] = ((prev << 1) | init) & b;
+			for(j = 1; j <= kerr; j++) {
+				cur = d[k][j];
+				d[k][j] = (((cur << 1) | init) & b) | (prev << 1) | init;
+				prev = cur;
+			}
+			if(!(m = d[k][kerr] & saw[k].fin) || i < ctx) continue;
+			for(; m; m &= m - 1) {
+				int bit = __builtin_ctzll(m), p = saw[k].pat[bit];
+				for(j = 0; !(d[k][j] >> bit & 1); j++);
+				kadd(w, base + i + 1 - pats[p].len, base + i + 1, p, j);
+			}
+		}
+		/* the terms around the pieces; a hit ending in the next block
+		   is found there again, as its pieces are in the overlap. a
+		   few pieces are found faster one by one with the kernel. */
+		for(q = 0; piecefind && q < npieces; q++) {
+			const unsigned char *p = buf, *e = buf + len;
+			for(; (p = find(p, e - p, pieces[q].s, pieces[q].len)); p++)
+				piece_hit(w, buf, ctx, len, base, q, p - buf);
+		}
+		for(i = 0; !piecefind && npieces && i < len; i++) {
+			if(!s && pac.nstart && (i = ac_skip(&pac, buf, i, len)) == len) break;
+			s = pac.go[s*256+buf[i]];
+			for(o = pac.out[s] != -1 ? s : pac.dict[s]; o != -1; o = pac.dict[o])
+				for(q = pac.out[o]; q != -1; q = piecenext[q])
+					piece_hit(w, buf, ctx, len, base, q, i + 1 - pieces[q].len);
+		}
+		qsort(w->kh, w->nkh, sizeof *w->kh, kh_cmp);
+		for(i = 0; i < w->nkh; i++) {
+			/* a term found by several of its pieces */
+			if(i && !kh_cmp(&w->kh[i-1], &w->kh[i])) continue;
+			if(report(w, w->kh[i].off, w->kh[i].end, w->kh[i].pat, w->kh[i].mism)) return 1;
+		}
+		return 0;
+	}
+	if(nsaw) return sa_search(w, buf, ctx, len, base, 0);
+	if(!ac.go) {
+		const unsigned char *p = buf, *e = buf + len;
+		if(ctx >= pats[0].len) p += ctx + 1 - pats[0].len;
+		while((p = find(p, e - p, pats[0].s, pats[0].len))) {
+			if(report(w, base + (p - buf), base + (p - buf) + pats[0].len, 0, 0)) return 1;
+			p++;
+		}
+		return 0;
+	}
+	int s = 0, o;
+	for(i = 0; i < len; i++) {
+		if(!s && ac.nstart && (i = ac_skip(&ac, buf, i, len)) == len) break;
+		s = ac.go[s*256+buf[i]];
+		if(i < ctx) continue;
+		for(o = ac.out[s] != -1 ? s : ac.dict[s]; o != -1; o = ac.dict[o])
+			if(report(w, base + i + 1 - pats[ac.out[o]].len, base + i + 1, ac.out[o], 0)) return 1;
+	}
+	return 0;
+}
+
+/* read-ahead engine. a reader keeps up to depth reads of bs bytes in
+   flight, via io_uring if the kernel has it and a helper thread
+   otherwise, and hands out the completed buffers in file order.
+   every buffer has pad bytes in front of it for the overlap, and its
+   data is page aligned so the reads can use O_DIRECT. */
+static size_t bs = BLOCKSIZE, pad;
+static int depth = 4, rfd, use_uring = 1, direct, sparse = 1;
+
+enum { SLOT_FREE, SLOT_BUSY, SLOT_FULL };
+
+struct uring {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+struct reader {
+	off_t next, end, data_end;
+	struct range *rg;
+	size_t nrg, ri;
+	unsigned cur, inflight;
+	int eof, quit, sparse, seq;
+	struct {
+		unsigned char *buf;
+		off_t off;
+		size_t want, ri;
+		ssize_t len;
+		int state, err;
+		struct iovec iov;
+	} *slot;
+	struct uring *ring;
+	pthread_t t;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+};
+
+static struct uring *uring_init(unsigned entries) {
+	struct io_uring_params p = {0};
+	struct uring *u;
+	size_t sqsz, cqsz;
+	char *sq, *cq;
+	int ufd = syscall(__NR_io_uring_setup, entries, &p);
+	if(ufd < 0) return 0;
+	sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP && cqsz > sqsz) sqsz = cqsz;
+	sq = mmap(0, sqsz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ufd, IORING_OFF_SQ_RING);
+	if(sq == MAP_FAILED) goto fail;
+	if(p.features & IORING_FEAT_SINGLE_MMAP) cq = sq;
+	else if((cq = mmap(0, cqsz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ufd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+		goto fail;
+	u = malloc(sizeof *u);
+	u->fd = ufd;
+	u->sq_tail = (void*) (sq + p.sq_off.tail);
+	u->sq_mask = (void*) (sq + p.sq_off.ring_mask);
+	u->sq_array = (void*) (sq + p.sq_off.array);
+	u->cq_head = (void*) (cq + p.cq_off.head);
+	u->cq_tail = (void*) (cq + p.cq_off.tail);
+	u->cq_mask = (void*) (cq + p.cq_off.ring_mask);
+	u->cqes = (void*) (cq + p.cq_off.cqes);
+	u->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+		       MAP_SHARED|MAP_POPULATE, ufd, IORING_OFF_SQES);
+	if(u->sqes != MAP_FAILED) return u;
+	free(u);
+fail:
+	/* the mappings go away with the process, rings are only set up once per worker */
+	close(ufd);
+	return 0;
+}
+
+/* a token bucket shared by all readers limits the read rate. up to a
+   tenth of a second of reads can be done at once after being idle. */
+static int ioidle, dropcache;
+static pthread_mutex_t tbmtx = PTHREAD_MUTEX_INITIALIZER;
+static double tbnext;
+
+static void throttle(size_t n) {
+	double t, wait;
+	struct timespec ts;
+	if(!maxrate) return;
+	pthread_mutex_lock(&tbmtx);
+	t = now();
+	if(tbnext < t - 0.1) tbnext = t - 0.1;
+	tbnext += n / maxrate;
+	wait = tbnext - t;
+	pthread_mutex_unlock(&tbmtx);
+	if(wait <= 0) return;
+	__atomic_add_fetch(&tbwaits, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&tbwaitus, (unsigned long long) (wait * 1e6), __ATOMIC_RELAXED);
+	ts.tv_sec = wait;
+	ts.tv_nsec = (wait - ts.tv_sec) * 1e9;
+	while(nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+/* with O_DIRECT, the length must be aligned too. reads past EOF are short. */
+static size_t io_len(size_t want) {
+	return direct ? (want + 4095) & ~(size_t) 4095 : want;
+}
+
+static int readerr;
+
+static void read_slot(struct reader *r, unsigned i) {
+	ssize_t n;
+	size_t got = 0;
+	do {
+		if(r->seq) n = read(rfd, r->slot[i].buf + got, r->slot[i].want - got);
+		else n = pread(rfd, r->slot[i].buf + got, io_len(r->slot[i].want - got), r->slot[i].off + got);
+		/* O_DIRECT needs aligned offsets, which ranges may not have */
+		if(n == -1 && errno == EINVAL && rfd != fd)
+			n = pread(fd, r->slot[i].buf + got, r->slot[i].want - got, r->slot[i].off + got);
+	} while(n > 0 && (got += n) < r->slot[i].want);
+	r->slot[i].len = got ? got : n;
+	r->slot[i].err = errno;
+	if(r->slot[i].len > (ssize_t) r->slot[i].want) r->slot[i].len = r->slot[i].want;
+}
+
+static void reader_fill(struct reader *r, unsigned i) {
+	throttle(r->slot[i].want);
+	read_slot(r, i);
+}
+
+/* queue the read of the next part of the ranges into slot i */
+static int reader_submit(struct reader *r, unsigned i) {
+	if(r->eof) return 0;
+	for(;;) {
+		if(!r->seq && r->next >= r->end) {
+			if(++r->ri >= r->nrg) return 0;
+			r->next = r->data_end = r->rg[r->ri].start;
+			r->end = r->rg[r->ri].end;
+			continue;
+		}
+		if(!r->sparse || r->next < r->data_end) break;
+		/* jump over holes, the consumer sees the gap in the offsets */
+		off_t d = lseek(fd, r->next, SEEK_DATA);
+		if(d == -1 && errno == ENXIO) d = r->end;
+		if(d == -1) r->sparse = 0;
+		else if(d >= r->end) r->next = r->end;
+		else {
+			r->next = d;
+			if((r->data_end = lseek(fd, d, SEEK_HOLE)) == -1) r->data_end = r->end;
+		}
+	}
+	r->slot[i].off = r->next;
+	r->slot[i].ri = r->ri;
+	r->slot[i].want = bs;
+	if(!r->seq && r->end - r->next < bs) r->slot[i].want = r->end - r->next;
+	if(r->sparse && r->data_end - r->next < r->slot[i].want) r->slot[i].want = r->data_end - r->next;
+	r->next += r->slot[i].want;
+	r->slot[i].state = SLOT_BUSY;
+	if(r->ring) {
+		struct uring *u = r->ring;
+		unsigned tail = *u->sq_tail, idx = tail & *u->sq_mask;
+		struct io_uring_sqe *sqe = &u->sqes[idx];
+		throttle(r->slot[i].want);
+		r->slot[i].iov.iov_base = r->slot[i].buf;
+		r->slot[i].iov.iov_len = io_len(r->slot[i].want);
+		memset(sqe, 0, sizeof *sqe);
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = rfd;
+		sqe->addr = (uintptr_t) &r->slot[i].iov;
+		sqe->len = 1;
+		sqe->off = r->slot[i].off;
+		sqe->ioprio = ioidle ? IOPRIO_IDLE : 0;
+		sqe->user_data = i;
+		u->sq_array[idx] = idx;
+		__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+		if(syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, 0, 0) != 1) {
+			/* do it synchronously instead */
+			__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+			read_slot(r, i);
+			r->slot[i].state = SLOT_FULL;
+			return 1;
+		}
+		r->inflight++;
+	}
+	return 1;
+}
+
+static void uring_reap(struct reader *r) {
+	struct uring *u = r->ring;
+	unsigned h = *u->cq_head;
+	while(h == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+		h = *u->cq_head;
+	}
+	struct io_uring_cqe *cqe = &u->cqes[h & *u->cq_mask];
+	unsigned i = cqe->user_data;
+	r->slot[i].len = cqe->res;
+	r->slot[i].err = -cqe->res;
+	if(r->slot[i].len > (ssize_t) r->slot[i].want) r->slot[i].len = r->slot[i].want;
+	r->slot[i].state = SLOT_FULL;
+	r->inflight--;
+	__atomic_store_n(u->cq_head, h + 1, __ATOMIC_RELEASE);
+}
+
+static void *reader_thread(void *arg) {
+	struct reader *r = arg;
+	unsigned i = 0;
+	pthread_mutex_lock(&r->mtx);
+	while(!r->quit) {
+		if(r->slot[i].state != SLOT_FREE) {
+			pthread_cond_wait(&r->cond, &r->mtx);
+			continue;
+		}
+		if(!reader_submit(r, i)) break;
+		pthread_mutex_unlock(&r->mtx);
+		reader_fill(r, i);
+		pthread_mutex_lock(&r->mtx);
+		r->slot[i].state = SLOT_FULL;
+		/* a read error where the file has no offsets can not be skipped */
+		if(!r->slot[i].len || (r->slot[i].len < 0 && r->seq)) r->eof = 1;
+		pthread_cond_broadcast(&r->cond);
+		i = (i + 1) % depth;
+	}
+	r->eof = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mtx);
+	return 0;
+}
+
+static void reader_open(struct reader *r, struct range *rg, size_t nrg) {
+	int i;
+	struct stat st;
+	memset(r, 0, sizeof *r);
+	r->rg = rg;
+	r->nrg = nrg;
+	r->next = r->data_end = rg[0].start;
+	r->end = rg[0].end;
+	r->seq = r->end == -1;
+	r->sparse = sparse && !r->seq && !fstat(fd, &st) && S_ISREG(st.st_mode);
+	r->slot = calloc(depth, sizeof *r->slot);
+	for(i = 0; i < depth; i++) {
+		void *p;
+		if(posix_memalign(&p, 4096, pad + bs)) abort();
+		r->slot[i].buf = (unsigned char*) p + pad;
+	}
+	if(depth == 1) return;
+	if(use_uring && !r->seq && (r->ring = uring_init(depth))) {
+		for(i = 0; i < depth; i++) reader_submit(r, i);
+		return;
+	}
+	pthread_mutex_init(&r->mtx, 0);
+	pthread_cond_init(&r->cond, 0);
+	if(pthread_create(&r->t, 0, reader_thread, r)) {
+		perror("pthread_create");
+		exit(1);
+	}
+}
+
+/* returns the length of the next buffer, which is stored in *buf,
+   its file offset in *off and the index of its range in *ri. a buffer
+   that could not be read is reported and has a negative length. */
+static ssize_t reader_next(struct reader *r, unsigned char **buf, off_t *off, size_t *ri) {
+	unsigned i = r->cur;
+	if(depth == 1) {
+		if(!reader_submit(r, i)) return 0;
+		reader_fill(r, i);
+	} else if(r->ring) {
+		if(r->slot[i].state == SLOT_FREE) return 0;
+		while(r->slot[i].state != SLOT_FULL) uring_reap(r);
+		/* the same fallbacks as without io_uring, like for O_DIRECT */
+		if(r->slot[i].len < 0) read_slot(r, i);
+		/* fill up short reads before the next slot's data */
+		if(r->slot[i].len > 0 && r->slot[i].len < r->slot[i].want) {
+			unsigned char *b = r->slot[i].buf;
+			off_t o = r->slot[i].off;
+			size_t w = r->slot[i].want;
+			r->slot[i].buf += r->slot[i].len;
+			r->slot[i].off += r->slot[i].len;
+			r->slot[i].want -= r->slot[i].len;
+			read_slot(r, i);
+			r->slot[i].len = r->slot[i].len > 0 ? (r->slot[i].buf - b) + r->slot[i].len : r->slot[i].buf - b;
+			r->slot[i].buf = b;
+			r->slot[i].off = o;
+			r->slot[i].want = w;
+		}
+	} else {
+		pthread_mutex_lock(&r->mtx);
+		while(r->slot[i].state != SLOT_FULL && !(r->eof && r->slot[i].state == SLOT_FREE))
+			pthread_cond_wait(&r->cond, &r->mtx);
+		pthread_mutex_unlock(&r->mtx);
+		if(r->slot[i].state != SLOT_FULL) return 0;
+	}
+	*buf = r->slot[i].buf;
+	*off = r->slot[i].off;
+	*ri = r->slot[i].ri;
+	if(r->slot[i].len < 0) {
+		pthread_mutex_lock(&lock);
+		if(neednl) dprintf(2, "\n");
+		neednl = 0;
+		dprintf(2, "read error at 0x%llx: %s\n", (unsigned long long) *off, strerror(r->slot[i].err));
+		readerr = 1;
+		pthread_mutex_unlock(&lock);
+		if(r->seq) r->eof = 1;
+	}
+	return r->slot[i].len;
+}
+
+/* hand the current buffer back for the next read */
+static void reader_release(struct reader *r) {
+	unsigned i = r->cur;
+	/* keep the pages of the services on a live disk in the cache */
+	if(dropcache && !direct && r->slot[i].len > 0)
+		posix_fadvise(fd, r->slot[i].off, r->slot[i].len, POSIX_FADV_DONTNEED);
+	r->cur = (i + 1) % depth;
+	if(depth == 1) return;
+	if(r->ring) {
+		r->slot[i].state = SLOT_FREE;
+		reader_submit(r, i);
+		return;
+	}
+	pthread_mutex_lock(&r->mtx);
+	r->slot[i].state = SLOT_FREE;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mtx);
+}
+
+static void reader_close(struct reader *r) {
+	int i;
+	if(r->ring) {
+		while(r->inflight) uring_reap(r);
+		close(r->ring->fd);
+		free(r->ring);
+	} else if(depth > 1) {
+		pthread_mutex_lock(&r->mtx);
+		r->quit = 1;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mtx);
+		pthread_join(r->t, 0);
+	}
+	for(i = 0; i < depth; i++) free(r->slot[i].buf - pad);
+	free(r->slot);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static int allzero_avx2(const unsigned char *p, size_t n) {
+	size_t i = 0;
+	for(; i + 128 <= n; i += 128) {
+		__m256i v = _mm256_or_si256(
+			_mm256_or_si256(_mm256_loadu_si256((const void*)(p + i)), _mm256_loadu_si256((const void*)(p + i + 32))),
+			_mm256_or_si256(_mm256_loadu_si256((const void*)(p + i + 64)), _mm256_loadu_si256((const void*)(p + i + 96))));
+		if(!_mm256_testz_si256(v, v)) return 0;
+	}
+	for(; i < n; i++) if(p[i]) return 0;
+	return 1;
+}
+#endif
+
+static int allzero_scalar(const unsigned char *p, size_t n) {
+	size_t i = 0;
+	uint64_t x, acc;
+	for(; i + 64 <= n; i += 64) {
+		int j;
+		for(acc = 0, j = 0; j < 64; j += 8) {
+			memcpy(&x, p + i + j, 8);
+			acc |= x;
+		}
+		if(acc) return 0;
+	}
+	for(; i < n; i++) if(p[i]) return 0;
+	return 1;
+}
+
+static int (*allzero)(const unsigned char *p, size_t n) = allzero_scalar;
+
+/* whether some term can match in a run of zeros. if not, the searcher
+   only needs to look at the first maxlen-1 bytes of a zero block, where
+   a hit can still overlap the end of the preceding data. */
+static int zero_hits(void) {
+	struct worker w = {.probe = 1};
+	unsigned char *z = calloc(1, 2 * maxlen);
+	search(&w, z, 0, 2 * maxlen, 0);
+	free(z);
+	return w.nhits != 0;
+}
+
+static void ring_push(struct carver *cv, const unsigned char *p, size_t n, off_t off) {
+	if(cv->rend != off) cv->rlen = 0;
+	cv->rend = off + n;
+	if(n > cv->rsize) {
+		if(p) p += n - cv->rsize;
+		n = cv->rsize;
+	}
+	while(n) {
+		size_t k = cv->rsize - cv->rhead < n ? cv->rsize - cv->rhead : n;
+		if(p) memcpy(cv->ring + cv->rhead, p, k), p += k;
+		else memset(cv->ring + cv->rhead, 0, k);
+		cv->rhead = (cv->rhead + k) % cv->rsize;
+		if((cv->rlen += k) > cv->rsize) cv->rlen = cv->rsize;
+		n -= k;
+	}
+}
+
+/* write the bytes from off up to the end of the ring */
+static void ring_write(struct carver *cv, int ofd, off_t off) {
+	size_t n = cv->rend - off, i = (cv->rhead + cv->rsize - n) % cv->rsize;
+	while(n) {
+		size_t k = cv->rsize - i < n ? cv->rsize - i : n;
+		write(ofd, cv->ring + i, k);
+		i = (i + k) % cv->rsize;
+		n -= k;
+	}
+}
+
+/* start the carves of the hits found in the n bytes at pos and pass
+   these bytes, or n zeros if p is 0, to all carves that want them. */
+static void carve_data(struct worker *w, const unsigned char *p, size_t n, off_t pos) {
+	static const unsigned char zeros[4096];
+	struct carver *cv = &w->cv;
+	size_t i, j;
+	for(i = 0; i < cv->nnew; i++) {
+		struct hit *h = &cv->newh[i];
+		struct carve c;
+		off_t s = h->off > carve_before ? h->off - carve_before : 0;
+		char fn[4096];
+		snprintf(fn, sizeof fn, "%s/carve-%012llx-%zu-%s.bin", carve_dir, (unsigned long long) h->off,
+			pats[h->pat].term, pats[h->pat].enc);
+		if((c.fd = open(fn, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1) {
+			perror(fn);
+			continue;
+		}
+		if(cv->rend == pos && s < pos) {
+			if(s < pos - (off_t) cv->rlen) s = pos - cv->rlen;
+			ring_write(cv, c.fd, s);
+		}
+		c.next = s > pos ? s : pos;
+		c.end = h->end + carve_after;
+		cv->pend = realloc(cv->pend, (cv->npend + 1) * sizeof *cv->pend);
+		cv->pend[cv->npend++] = c;
+	}
+	cv->nnew = 0;
+	for(i = 0; i < cv->npend; ) {
+		struct carve *c = &cv->pend[i];
+		off_t e = c->end < pos + n ? c->end : pos + n;
+		for(; c->next < e; c->next += j) {
+			j = e - c->next;
+			if(p) write(c->fd, p + (c->next - pos), j);
+			else write(c->fd, zeros, j = j < sizeof zeros ? j : sizeof zeros);
+		}
+		if(c->next < c->end) i++;
+		else {
+			close(c->fd);
+			*c = cv->pend[--cv->npend];
+		}
+	}
+	ring_push(cv, p, n, pos);
+}
+
+/* a carve that reaches past the end of the range of its worker gets
+   the rest of its data read directly */
+static void carve_finish(struct worker *w) {
+	struct carver *cv = &w->cv;
+	unsigned char buf[4096];
+	size_t i;
+	ssize_t n;
+	for(i = 0; i < cv->npend; i++) {
+		struct carve *c = &cv->pend[i];
+		for(; c->next < c->end; c->next += n) {
+			n = c->end - c->next < sizeof buf ? c->end - c->next : sizeof buf;
+			if((n = pread(fd, buf, n, c->next)) <= 0) break;
+			write(c->fd, buf, n);
+		}
+		close(c->fd);
+	}
+	free(cv->pend);
+	free(cv->newh);
+	free(cv->ring);
+}
+
+static int skipzero;
+
+/* search the n bytes following the ctx bytes in ctxbuf for hits, and
+   shift them into ctxbuf. zero blocks are only searched as far as
+   a hit could reach into them. returns nonzero to stop the scan. */
+static int feed(struct worker *w, unsigned char *buf, size_t n, unsigned char *ctxbuf, size_t *ctx, off_t pos) {
+	size_t ctxmax = maxlen - 1, len = n;
+	memcpy(buf - *ctx, ctxbuf, *ctx);
+	if(skipzero && n > ctxmax && allzero(buf, n)) {
+		len = ctxmax;
+		__atomic_store_n(&w->skipped, w->skipped + n - len, __ATOMIC_RELAXED);
+	}
+	int ret = search(w, buf - *ctx, *ctx, *ctx + len, pos - *ctx);
+	if(carving) carve_data(w, buf, n, pos);
+	if(ret) return 1;
+	if((*ctx += n) > ctxmax) *ctx = ctxmax;
+	memcpy(ctxbuf, buf + n - *ctx, *ctx);
+	return 0;
+}
+
+/* a hole of n bytes reads as zeros, only the start of it can hold a hit */
+static int feed_hole(struct worker *w, unsigned char *ctxbuf, size_t *ctx, off_t pos, off_t n) {
+	size_t ctxmax = maxlen - 1, k = n < ctxmax ? n : ctxmax;
+	unsigned char *tmp = calloc(1, 2 * ctxmax + 1);
+	int ret = feed(w, tmp + ctxmax, k, ctxbuf, ctx, pos);
+	free(tmp);
+	if(carving && !ret) carve_data(w, 0, n - k, pos + k);
+	__atomic_store_n(&w->skipped, w->skipped + n - k, __ATOMIC_RELAXED);
+	return ret;
+}
+
+struct scanstate {
+	size_t ri, ctx;
+	off_t pos;
+	unsigned char *ctxbuf;
+};
+
+static void advance(struct worker *w, struct scanstate *sc, off_t pos) {
+	__atomic_store_n(&w->scanned, w->scanned + pos - sc->pos, __ATOMIC_RELAXED);
+	__atomic_store_n(&w->pos, sc->pos = pos, __ATOMIC_RELAXED);
+}
+
+/* start scanning range i. the overlap and the carve context are read
+   from before it if it continues the data there. */
+static void range_begin(struct worker *w, struct scanstate *sc, size_t i) {
+	struct range *g = &w->rg[i];
+	size_t ctxmax = maxlen - 1, k;
+	sc->ri = i;
+	sc->pos = g->start;
+	__atomic_store_n(&w->pos, sc->pos, __ATOMIC_RELAXED);
+	sc->ctx = 0;
+	if(carving) w->cv.rend = -1;
+	if(!g->cont || g->end == -1) return;
+	k = g->start < ctxmax ? g->start : ctxmax;
+	if(pread(fd, sc->ctxbuf, k, g->start - k) == k) sc->ctx = k;
+	if(carving) {
+		struct carver *cv = &w->cv;
+		unsigned char *tmp;
+		k = g->start < cv->rsize ? g->start : cv->rsize;
+		tmp = malloc(k);
+		if(pread(fd, tmp, k, g->start - k) == k) ring_push(cv, tmp, k, g->start - k);
+		free(tmp);
+	}
+}
+
+/* finish the current range and the ranges up to range i, all of which
+   the reader skipped as holes, and begin range i. returns nonzero to
+   stop the scan. */
+static int range_goto(struct worker *w, struct scanstate *sc, size_t i, int holes) {
+	for(;;) {
+		if(sc->ri != (size_t) -1) {
+			off_t e = w->rg[sc->ri].end;
+			if(holes && sc->pos < e && feed_hole(w, sc->ctxbuf, &sc->ctx, sc->pos, e - sc->pos))
+				return 1;
+			advance(w, sc, e);
+		}
+		if(sc->ri + 1 >= w->nrg || sc->ri + 1 > i) return 0;
+		range_begin(w, sc, sc->ri + 1);
+		if(sc->ri == i) return 0;
+	}
+}
+
+/* a worker with a range ending at -1 reads sequentially until EOF,
+   which is used when the file size is unknown. */
+static void *scan(void *arg) {
+	struct worker *w = arg;
+	struct reader r;
+	/* the last maxlen-1 bytes of each block are kept in front of
+	   the next one so hits spanning two blocks are found. */
+	struct scanstate sc = {.ri = -1, .ctxbuf = malloc(maxlen)};
+	unsigned char *buf;
+	off_t off;
+	size_t ri;
+	ssize_t n;
+	if(!w->nrg) goto out;
+	if(carving) {
+		/* the ring holds the context before a hit starting in the overlap */
+		w->cv.rsize = carve_before + maxlen;
+		w->cv.ring = malloc(w->cv.rsize);
+	}
+	reader_open(&r, w->rg, w->nrg);
+	while(!stop && (n = reader_next(&r, &buf, &off, &ri))) {
+		if(ri != sc.ri && range_goto(w, &sc, ri, r.sparse)) break;
+		if(off > sc.pos && feed_hole(w, sc.ctxbuf, &sc.ctx, sc.pos, off - sc.pos)) break;
+		if(n < 0) {
+			/* the block is skipped, and with it the overlap. carved
+			   files get zeros for it. */
+			if(carving) carve_data(w, 0, r.slot[r.cur].want, off);
+			sc.ctx = 0;
+			advance(w, &sc, off + r.slot[r.cur].want);
+			reader_release(&r);
+			if(r.seq) break;
+			continue;
+		}
+		if(feed(w, buf, n, sc.ctxbuf, &sc.ctx, off)) break;
+		advance(w, &sc, off + n);
+		if(w->id == head) {
+			pthread_mutex_lock(&lock);
+			if(w->id == head) release(off + n);
+			pthread_mutex_unlock(&lock);
+		}
+		reader_release(&r);
+	}
+	/* holes up to the end of the last ranges */
+	if(!stop && r.sparse) range_goto(w, &sc, w->nrg, 1);
+	reader_close(&r);
+	if(carving) carve_finish(w);
+out:
+	free(sc.ctxbuf);
+	finish(w);
+	return 0;
+}
+
+/* identifies the terms, so a checkpoint is only resumed for the same search */
+static unsigned long long terms_hash(void) {
+	unsigned long long h = 14695981039346656037ULL;
+	size_t i, j;
+	for(i = 0; i < npats; i++) {
+		for(j = 0; j < pats[i].len; j++) h = (h ^ pats[i].s[j]) * 1099511628211ULL;
+		for(j = 0; pats[i].cls && j < pats[i].len * 32; j++)
+			h = (h ^ pats[i].cls[0][j]) * 1099511628211ULL;
+		h = (h ^ (0x100 | pats[i].icase)) * 1099511628211ULL;
+		h = (h ^ kerr) * 1099511628211ULL;
+	}
+	return h;
+}
+
+/* the ranges to scan, in offset order */
+static struct range *ranges;
+static size_t nranges;
+
+static void add_range(off_t start, off_t end) {
+	if(end != -1 && end <= start) return;
+	ranges = realloc(ranges, (nranges + 1) * sizeof *ranges);
+	ranges[nranges].start = start;
+	ranges[nranges].end = end;
+	/* a hit may cross into it from the range before */
+	ranges[nranges].cont = nranges && ranges[nranges-1].end == start;
+	nranges++;
+}
+
+static unsigned long long ranges_hash(void) {
+	unsigned long long h = 14695981039346656037ULL;
+	size_t i;
+	for(i = 0; i < nranges; i++)
+		h = ((h ^ ranges[i].start) * 1099511628211ULL ^ ranges[i].end) * 1099511628211ULL;
+	return h;
+}
+
+/* give every worker an equal share of the bytes of the ranges. ranges
+   are cut at page aligned offsets, the part after a cut continues the
+   data before it. */
+static void split_ranges(void) {
+	off_t total = 0, per, left;
+	size_t i;
+	int w = 0;
+	for(i = 0; i < nranges; i++) total += ranges[i].end - ranges[i].start;
+	if(nranges && ranges[0].end == -1) nworkers = 1;
+	per = (total / nworkers + bs - 1) / bs * bs;
+	if(per < bs) per = bs;
+	left = per;
+	workers = calloc(nworkers, sizeof *workers);
+	for(i = 0; i < nranges; i++) {
+		off_t s = ranges[i].start, e = ranges[i].end;
+		int cont = ranges[i].cont;
+		while(e == -1 || s < e) {
+			off_t take = e == -1 ? -1 : e - s;
+			struct worker *wk = &workers[w];
+			if(w < nworkers - 1 && take > left) {
+				take = ((s + left) & ~(off_t) 4095) - s;
+				if(take <= 0) take = left;
+			}
+			wk->rg = realloc(wk->rg, (wk->nrg + 1) * sizeof *wk->rg);
+			wk->rg[wk->nrg].start = s;
+			wk->rg[wk->nrg].end = take == -1 ? -1 : s + take;
+			wk->rg[wk->nrg].cont = cont;
+			wk->nrg++;
+			if(take == -1) break;
+			s += take;
+			cont = 1;
+			if((left -= take) <= 0 && w < nworkers - 1) {
+				w++;
+				left = per;
+			}
+		}
+	}
+	nworkers = w + 1;
+	for(w = 0; w < nworkers; w++) {
+		workers[w].id = w;
+		if(!workers[w].nrg) continue;
+		workers[w].pos = workers[w].start = workers[w].rg[0].start;
+		workers[w].end = workers[w].rg[workers[w].nrg-1].end;
+	}
+}
+
+/* the checkpoint holds the position of every worker and all hits that
+   end before the position of their worker. everything up to there has
+   been searched, so a resumed scan neither loses nor repeats hits. */
+static void checkpoint(off_t size) {
+	char tmp[4096];
+	struct hit *h;
+	size_t i, n;
+	int j;
+	FILE *f;
+	snprintf(tmp, sizeof tmp, "%s.tmp", cpfile);
+	if(!(f = fopen(tmp, "w"))) {
+		perror(tmp);
+		return;
+	}
+	off_t *pos = malloc(nworkers * sizeof *pos);
+	for(j = 0; j < nworkers; j++) pos[j] = __atomic_load_n(&workers[j].pos, __ATOMIC_RELAXED);
+	fprintf(f, "fastfind checkpoint 1\nsize %lld jobs %d terms %llx ranges %llx\n",
+		(long long) size, nworkers, terms_hash(), ranges_hash());
+	for(j = 0; j < nworkers; j++)
+		fprintf(f, "range %lld %lld %lld\n", (long long) workers[j].start,
+			(long long) workers[j].end, (long long) pos[j]);
+	pthread_mutex_lock(&lock);
+	for(j = -2; j < nworkers; j++) {
+		h = j == -2 ? printed : j == -1 ? held : workers[j].hits;
+		n = j == -2 ? nprinted : j == -1 ? nheld : workers[j].nhits;
+		for(i = 0; i < n; i++) {
+			int k = 0;
+			while(k + 1 < nworkers && h[i].end > workers[k].end) k++;
+			if(h[i].end <= pos[k])
+				fprintf(f, "hit %lld %lld %zu %d\n", (long long) h[i].off,
+					(long long) h[i].end, h[i].pat, h[i].mism);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	free(pos);
+	if(fflush(f) || fsync(fileno(f)) || fclose(f) || rename(tmp, cpfile))
+		perror(cpfile);
+}
+
+/* reads the header of the checkpoint and sets the number of workers.
+   returns 0 and sets *fp to 0 if there is no checkpoint yet, and -1
+   if it can not be used. */
+static int resume_open(off_t size, FILE **fp) {
+	FILE *f = *fp = fopen(cpfile, "r");
+	long long a;
+	unsigned long long th, rh;
+	int n;
+	if(!f) return errno == ENOENT ? 0 : (perror(cpfile), -1);
+	if(fscanf(f, "fastfind checkpoint 1 size %lld jobs %d terms %llx ranges %llx", &a, &n, &th, &rh) != 4
+	   || a != size || n < 1 || th != terms_hash() || rh != ranges_hash()) {
+		dprintf(2, "%s: checkpoint is for a different file or search\n", cpfile);
+		fclose(f);
+		return -1;
+	}
+	nworkers = n;
+	return 0;
+}
+
+/* sets up the workers, which were split like in the checkpointed run,
+   to continue from their saved positions */
+static int resume(FILE *f) {
+	long long a, b, c;
+	size_t pat, j;
+	int i, n;
+	for(i = 0; i < nworkers; i++) {
+		struct worker *w = &workers[i];
+		if(fscanf(f, " range %lld %lld %lld", &a, &b, &c) != 3 || (w->nrg && (a != w->start || b != w->end)))
+			goto bad;
+		w->pos = c;
+		/* drop the ranges that are done, and continue in the current one */
+		for(j = 0; j < w->nrg && w->rg[j].end <= c; j++);
+		memmove(w->rg, w->rg + j, (w->nrg -= j) * sizeof *w->rg);
+		if(w->nrg && w->rg[0].start < c) {
+			w->rg[0].start = c;
+			w->rg[0].cont = 1;
+		}
+	}
+	while(fscanf(f, " hit %lld %lld %zu %d", &a, &b, &pat, &n) == 4) {
+		struct hit h = {.off = a, .end = b, .pat = pat, .mism = n};
+		if(pat >= npats) goto bad;
+		for(i = 0; i + 1 < nworkers && b > workers[i].end; i++);
+		add_hit(&workers[i], &h);
+	}
+	fclose(f);
+	/* the hits of the first worker are printed right away */
+	for(pat = 0; pat < workers[0].nhits && !stop; pat++) print_hit(&workers[0].hits[pat]);
+	workers[0].nhits = 0;
+	return 0;
+bad:
+	dprintf(2, "%s: corrupt checkpoint\n", cpfile);
+	fclose(f);
+	return -1;
+}
+
+static volatile int interrupted;
+static void sigint(int nsig) {
+	interrupted = stop = 1;
+}
+
+static size_t getsz(const char *s) {
+	char *e;
+	size_t n = strtoull(s, &e, 0);
+	switch(*e) {
+	case 'g': case 'G': n *= 1024;
+	case 'm': case 'M': n *= 1024;
+	case 'k': case 'K': n *= 1024;
+	}
+	return n;
+}
+
+static off_t getsize(int fd) {
+	struct stat st;
+	uint64_t sz;
+	if(fstat(fd, &st)) return -1;
+	if(S_ISREG(st.st_mode)) return st.st_size;
+	if(S_ISBLK(st.st_mode) && !ioctl(fd, BLKGETSIZE64, &sz)) return sz;
+	return -1;
+}
+
+static uint64_t le(const unsigned char *p, int n) {
+	uint64_t v = 0;
+	while(n--) v = v << 8 | p[n];
+	return v;
+}
+
+static void add_part(int num, off_t start, off_t end, const char *type) {
+	parts = realloc(parts, (nparts + 1) * sizeof *parts);
+	parts[nparts].num = num;
+	parts[nparts].start = start;
+	parts[nparts].end = end;
+	snprintf(parts[nparts].type, sizeof parts[nparts].type, "%s", type);
+	nparts++;
+}
+
+static int read_gpt(unsigned ss) {
+	unsigned char h[512], *e;
+	uint64_t lba, first, last;
+	unsigned n, esz, i, j;
+	char type[64];
+	if(pread(fd, h, sizeof h, ss) != sizeof h || memcmp(h, "EFI PART", 8)) return -1;
+	lba = le(h + 72, 8);
+	n = le(h + 80, 4);
+	esz = le(h + 84, 4);
+	if(esz < 128 || esz > 4096 || n > 4096) return -1;
+	e = malloc(esz);
+	for(i = 0; i < n; i++) {
+		if(pread(fd, e, esz, lba * ss + (off_t) i * esz) != esz) break;
+		for(j = 0; j < 16 && !e[j]; j++);
+		if(j == 16) continue;
+		first = le(e + 32, 8);
+		last = le(e + 40, 8);
+		/* the name is UTF-16LE, keep the ASCII of it */
+		for(j = 0; j < 36 && j < sizeof type - 1 && e[56 + 2*j]; j++)
+			type[j] = e[57 + 2*j] || e[56 + 2*j] < 32 || e[56 + 2*j] > 126 ? '?' : e[56 + 2*j];
+		type[j] = 0;
+		if(!j) snprintf(type, sizeof type, "gpt");
+		add_part(i + 1, first * ss, (last + 1) * ss, type);
+	}
+	free(e);
+	return 0;
+}
+
+static int read_mbr(unsigned ss) {
+	unsigned char b[512], *e;
+	uint64_t ext = 0, ebr;
+	char type[64];
+	int i, num = 5;
+	if(pread(fd, b, sizeof b, 0) != sizeof b || b[510] != 0x55 || b[511] != 0xaa) return -1;
+	for(i = 0; i < 4; i++) {
+		e = b + 446 + 16 * i;
+		if(e[4] == 0xee) return read_gpt(ss);
+	}
+	for(i = 0; i < 4; i++) {
+		e = b + 446 + 16 * i;
+		if(!e[4] || !le(e + 12, 4)) continue;
+		if(e[4] == 0x05 || e[4] == 0x0f || e[4] == 0x85) {
+			ext = le(e + 8, 4);
+			continue;
+		}
+		snprintf(type, sizeof type, "mbr-0x%02x", e[4]);
+		add_part(i + 1, le(e + 8, 4) * ss, (le(e + 8, 4) + le(e + 12, 4)) * ss, type);
+	}
+	/* logical partitions are a chain of EBRs in the extended one */
+	for(ebr = ext; ebr && num < 5 + 128; num++) {
+		if(pread(fd, b, sizeof b, ebr * ss) != sizeof b || b[510] != 0x55 || b[511] != 0xaa) break;
+		e = b + 446;
+		if(e[4] && le(e + 12, 4)) {
+			snprintf(type, sizeof type, "mbr-0x%02x", e[4]);
+			add_part(num, (ebr + le(e + 8, 4)) * ss, (ebr + le(e + 8, 4) + le(e + 12, 4)) * ss, type);
+		}
+		e += 16;
+		ebr = e[4] && le(e + 8, 4) ? ext + le(e + 8, 4) : 0;
+	}
+	return 0;
+}
+
+static int part_cmp(const void *a, const void *b) {
+	const struct part *x = a, *y = b;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int read_partitions(void) {
+	struct stat st;
+	int ss = 512;
+	if(!fstat(fd, &st) && S_ISBLK(st.st_mode)) ioctl(fd, BLKSSZGET, &ss);
+	if(read_mbr(ss) && (ss != 512 || read_mbr(4096))) {
+		dprintf(2, "no partition table found\n");
+		return -1;
+	}
+	/* a GPT of a disk with 4K sectors copied to a file */
+	if(!nparts && ss == 512) read_gpt(4096);
+	qsort(parts, nparts, sizeof *parts, part_cmp);
+	return 0;
+}
+
+static void list_partitions(off_t size) {
+	int i;
+	for(i = 0; i < nparts; i++)
+		printf("%d 0x%llx 0x%llx %s%s\n", parts[i].num, (unsigned long long) parts[i].start,
+			(unsigned long long) parts[i].end, parts[i].type,
+			size != -1 && parts[i].end > size ? " (beyond end)" : "");
+}
+
+/* the selected partitions and, with unpart, the space outside of all
+   partitions become the ranges to scan */
+static int select_partitions(off_t size) {
+	off_t at = 0;
+	int i, j;
+	if(size == -1) {
+		dprintf(2, "can not read partitions of a file of unknown size\n");
+		return -1;
+	}
+	if(read_partitions()) return -1;
+	for(j = 0; j < nselparts; j++) {
+		for(i = 0; i < nparts && parts[i].num != selparts[j]; i++);
+		if(i == nparts) {
+			dprintf(2, "no partition %d\n", selparts[j]);
+			return -1;
+		}
+	}
+	for(i = 0; i <= nparts; i++) {
+		off_t s = i < nparts ? parts[i].start : size;
+		if(s > size) s = size;
+		if(unpart && s > at) add_range(at, s);
+		if(i == nparts) break;
+		for(j = 0; j < nselparts && selparts[j] != parts[i].num; j++);
+		if(j < nselparts) add_range(s, parts[i].end < size ? parts[i].end : size);
+		if(parts[i].end > at) at = parts[i].end;
+	}
+	if(!nranges) {
+		dprintf(2, "nothing to scan\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* replaces the ranges by the free blocks of the ext2/3/4 file systems
+   starting at each of them. the free space is where deleted files are. */
+static int freeonly;
+
+/* whether group g has a copy of the superblock */
+static int ext_has_super(const unsigned char *sb, uint64_t g) {
+	uint64_t p;
+	if(le(sb + 92, 4) & 0x200)	/* sparse_super2 */
+		return !g || g == le(sb + 0x24c, 4) || g == le(sb + 0x250, 4);
+	if(g <= 1 || !(le(sb + 100, 4) & 1)) return 1;
+	if(!(g & 1)) return 0;
+	for(p = 3; p <= 7; p += 2) {
+		uint64_t x = p;
+		while(x < g) x *= p;
+		if(x == g) return 1;
+	}
+	return 0;
+}
+
+/* the block of the descriptor of group g. with meta_bg, the groups
+   after the first ones have their descriptors in the first block of
+   their meta group, after the superblock if there is one. */
+static uint64_t ext_desc_block(const unsigned char *sb, unsigned bsz, unsigned bpg, unsigned first, unsigned dsz, uint64_t g) {
+	uint64_t mg = g / (bsz / dsz);
+	if(!(le(sb + 96, 4) & 0x10) || mg < le(sb + 0x104, 4)) return first + 1 + mg;
+	g = mg * (bsz / dsz);
+	return first + g * bpg + ext_has_super(sb, g);
+}
+
+static int ext_free(off_t base, off_t end, struct range **out, size_t *nout) {
+	unsigned char sb[1024], d[64], *bm;
+	uint64_t blocks, g, ngroups, b, bmblk, from = -1;
+	unsigned bsz, bpg, first, dsz, i;
+	if(pread(fd, sb, sizeof sb, base + 1024) != sizeof sb || le(sb + 56, 2) != 0xef53) {
+		dprintf(2, "no ext2/3/4 file system at 0x%llx\n", (unsigned long long) base);
+		return -1;
+	}
+	bsz = 1024 << le(sb + 24, 4);
+	bpg = le(sb + 32, 4);
+	first = le(sb + 20, 4);
+	blocks = le(sb + 4, 4);
+	dsz = 32;
+	if(le(sb + 96, 4) & 0x80) {	/* 64bit */
+		blocks |= le(sb + 336, 4) << 32;
+		dsz = le(sb + 254, 2);
+	}
+	if(bsz > 65536 || !bpg || bpg > 8 * bsz || dsz < 32 || dsz > sizeof d) {
+		dprintf(2, "unsupported ext2/3/4 file system at 0x%llx\n", (unsigned long long) base);
+		return -1;
+	}
+	if(end > base + (off_t) (blocks * bsz)) end = base + blocks * bsz;
+	ngroups = (blocks - first + bpg - 1) / bpg;
+	bm = malloc(bsz);
+	for(g = 0; g < ngroups; g++) {
+		uint64_t gstart = first + g * bpg;
+		off_t dpos = (off_t) ext_desc_block(sb, bsz, bpg, first, dsz, g) * bsz + g % (bsz / dsz) * dsz;
+		if(pread(fd, d, dsz, base + dpos) != dsz) goto bad;
+		bmblk = le(d, 4) | (dsz >= 64 ? le(d + 0x20, 4) << 32 : 0);
+		if(bmblk >= blocks) goto bad;
+		/* BLOCK_UNINIT groups have no bitmap yet, everything but some
+		   metadata is free, which is scanned along */
+		if(le(d + 0x12, 2) & 2) memset(bm, 0, bsz);
+		else if(pread(fd, bm, bsz, base + (off_t) bmblk * bsz) != bsz) goto bad;
+		for(i = 0; i < bpg && gstart + i < blocks; i++) {
+			b = gstart + i;
+			if(!(bm[i >> 3] >> (i & 7) & 1)) {
+				if(from == (uint64_t) -1) from = b;
+				continue;
+			}
+			if(from == (uint64_t) -1) continue;
+			/* runs of free blocks, also across groups, are one range */
+			*out = realloc(*out, (*nout + 1) * sizeof **out);
+			(*out)[(*nout)++] = (struct range) {base + (off_t) from * bsz, base + (off_t) b * bsz, 0};
+			from = -1;
+		}
+	}
+	if(from != (uint64_t) -1) {
+		*out = realloc(*out, (*nout + 1) * sizeof **out);
+		(*out)[(*nout)++] = (struct range) {base + (off_t) from * bsz, end, 0};
+	}
+	free(bm);
+	return 0;
+bad:
+	dprintf(2, "can not read the block groups of the file system at 0x%llx\n", (unsigned long long) base);
+	free(bm);
+	return -1;
+}
+
+static int free_ranges(void) {
+	struct range *out = 0;
+	size_t i, nout = 0;
+	for(i = 0; i < nranges; i++)
+		if(ext_free(ranges[i].start, ranges[i].end, &out, &nout)) return -1;
+	/* clip to the ranges, a file system may claim more than it got */
+	size_t j = 0, n = 0;
+	for(i = 0; i < nout; i++) {
+		while(j < nranges && out[i].start >= ranges[j].end) j++;
+		if(j == nranges) break;
+		if(out[i].end > ranges[j].end) out[i].end = ranges[j].end;
+		if(out[i].start < out[i].end) out[n++] = out[i];
+	}
+	free(ranges);
+	ranges = out;
+	nranges = n;
+	if(!nranges) {
+		dprintf(2, "no free blocks\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* the index has a trigram filter for every block of the image: a bloom
+   filter with one hash of all trigrams starting in the block. bit 0 is
+   always set, so a filter of zeros marks a block that is not indexed
+   yet and an interrupted build can be continued. a term starting in
+   block b can only be there if all its trigrams are in filter b or
+   b+1, so a query reads only those blocks. */
+#define IXHEAD 4096
+
+static struct {
+	unsigned char *map;
+	size_t block, filter, len;
+	unsigned shift;
+	off_t size;
+	uint64_t nblocks;
+} ix = {.block = 64*1024};
+static uint64_t ixbits, ixfull;
+static const char *ixfile;
+
+static unsigned ix_bit(uint32_t t) {
+	return (t * 0x9e3779b1u) >> ix.shift;
+}
+
+static unsigned char *ix_filter(uint64_t b) {
+	return ix.map + IXHEAD + b * ix.filter;
+}
+
+static int ix_open(off_t size, int create) {
+	char head[IXHEAD];
+	long long sz;
+	int f, l;
+	if((f = open(ixfile, create ? O_RDWR|O_CREAT : O_RDONLY, 0666)) == -1) {
+		perror(ixfile);
+		return -1;
+	}
+	memset(head, 0, sizeof head);
+	if(pread(f, head, sizeof head - 1, 0) > 0) {
+		if(sscanf(head, "fastfind index 1 size %lld block %zu filter %zu", &sz, &ix.block, &ix.filter) != 3) {
+			dprintf(2, "%s: not an index\n", ixfile);
+			return -1;
+		}
+		if(sz != size) {
+			dprintf(2, "%s: index is for a different file\n", ixfile);
+			return -1;
+		}
+	} else if(!create) {
+		dprintf(2, "%s: not an index\n", ixfile);
+		return -1;
+	} else if(!ix.filter) {
+		/* a bit per byte of the block keeps the filters of text and
+		   code mostly empty */
+		for(ix.filter = 64; ix.filter < ix.block / 8 && ix.filter < 1 << 28; ix.filter <<= 1);
+	}
+	if(!ix.block || ix.filter < 64 || ix.filter > 1 << 28 || ix.filter & (ix.filter - 1)) {
+		dprintf(2, "the filter size must be a power of two of at least 64\n");
+		return -1;
+	}
+	for(l = 0; (size_t) 1 << l < 8 * ix.filter; l++);
+	ix.shift = 32 - l;
+	ix.size = size;
+	ix.nblocks = (size + ix.block - 1) / ix.block;
+	ix.len = IXHEAD + ix.nblocks * ix.filter;
+	if(create && !*head) {
+		l = snprintf(head, sizeof head, "fastfind index 1\nsize %lld block %zu filter %zu\n",
+			(long long) size, ix.block, ix.filter);
+		if(ftruncate(f, ix.len) || pwrite(f, head, l, 0) != l) {
+			perror(ixfile);
+			return -1;
+		}
+	}
+	ix.map = mmap(0, ix.len, create ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, f, 0);
+	close(f);
+	if(ix.map == MAP_FAILED) {
+		perror(ixfile);
+		return -1;
+	}
+	return 0;
+}
+
+/* the trigrams of the bytes streamed through a worker */
+struct ixstate {
+	uint32_t tri;
+	int have;
+	off_t p;
+	uint64_t cb;
+	unsigned char *f;
+};
+
+static void ix_switch(struct ixstate *st, uint64_t b) {
+	if(st->cb != (uint64_t) -1) {
+		uint64_t bits = 0, *q = (uint64_t *) st->f;
+		size_t i;
+		st->f[0] |= 1;
+		memcpy(ix_filter(st->cb), st->f, ix.filter);
+		for(i = 0; i < ix.filter / 8; i++) bits += __builtin_popcountll(q[i]);
+		__atomic_add_fetch(&ixbits, bits, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&ixfull, 1, __ATOMIC_RELAXED);
+	}
+	st->cb = b;
+	memset(st->f, 0, ix.filter);
+}
+
+static void ix_bytes(struct ixstate *st, const unsigned char *p, size_t n) {
+	while(n) {
+		if(st->have < 2) {
+			st->tri = st->tri << 8 | *p++;
+			st->have++;
+			st->p++;
+			n--;
+			continue;
+		}
+		/* the next byte completes the trigram starting 2 bytes before */
+		off_t s = st->p - 2;
+		uint64_t b = s / ix.block;
+		size_t i, k = (b + 1) * ix.block - s;
+		uint32_t t = st->tri;
+		unsigned char *f = st->f;
+		if(b != st->cb) ix_switch(st, b);
+		if(k > n) k = n;
+		for(i = 0; i < k; i++) {
+			unsigned h;
+			t = (t << 8 | p[i]) & 0xffffff;
+			h = ix_bit(t);
+			f[h >> 3] |= 1 << (h & 7);
+		}
+		st->tri = t;
+		st->p += k;
+		p += k;
+		n -= k;
+	}
+}
+
+/* holes contain only the zero trigram after the first two bytes */
+static void ix_zeros(struct ixstate *st, off_t n) {
+	static const unsigned char z[2];
+	uint64_t b, last;
+	unsigned h = ix_bit(0);
+	size_t k = n < 2 ? n : 2;
+	ix_bytes(st, z, k);
+	if(!(n -= k)) return;
+	last = (st->p + n - 3) / ix.block;
+	for(b = (st->p - 2) / ix.block; b <= last; b++) {
+		if(b != st->cb) ix_switch(st, b);
+		st->f[h >> 3] |= 1 << (h & 7);
+	}
+	st->p += n;
+}
+
+/* the end of range ri, past the holes the reader skipped */
+static void ix_end(struct worker *w, struct ixstate *st, size_t ri, int holes) {
+	off_t e = w->rg[ri].end;
+	if(holes && st->p < e) {
+		__atomic_store_n(&w->skipped, w->skipped + e - st->p, __ATOMIC_RELAXED);
+		__atomic_store_n(&w->scanned, w->scanned + e - st->p, __ATOMIC_RELAXED);
+		ix_zeros(st, e - st->p);
+	}
+	ix_switch(st, -1);
+}
+
+static void *ix_build(void *arg) {
+	struct worker *w = arg;
+	struct ixstate st = {.cb = -1, .f = malloc(ix.filter)};
+	struct reader r;
+	unsigned char *buf;
+	off_t off;
+	size_t ri, cur = -1;
+	ssize_t n;
+	if(!w->nrg) goto out;
+	reader_open(&r, w->rg, w->nrg);
+	while(!stop && (n = reader_next(&r, &buf, &off, &ri)) > 0) {
+		while(cur != ri) {
+			if(cur != (size_t) -1) ix_end(w, &st, cur, r.sparse);
+			cur++;
+			st.have = 0;
+			st.p = w->rg[cur].start;
+		}
+		if(off > st.p) {
+			__atomic_store_n(&w->skipped, w->skipped + off - st.p, __ATOMIC_RELAXED);
+			ix_zeros(&st, off - st.p);
+		}
+		ix_bytes(&st, buf, n);
+		__atomic_store_n(&w->pos, st.p, __ATOMIC_RELAXED);
+		__atomic_store_n(&w->scanned, w->scanned + n, __ATOMIC_RELAXED);
+		reader_release(&r);
+	}
+	/* a block is only written when complete, so nothing is written
+	   for the block an interrupted worker was in */
+	if(!stop) while(cur + 1 <= w->nrg) {
+		if(cur != (size_t) -1) ix_end(w, &st, cur, r.sparse);
+		if(++cur == w->nrg) break;
+		st.have = 0;
+		st.p = w->rg[cur].start;
+	}
+	reader_close(&r);
+out:
+	free(st.f);
+	finish(w);
+	return 0;
+}
+
+/* splits the blocks not indexed yet across the workers. every worker
+   reads 2 bytes past its blocks for the trigrams starting at their end. */
+static void ix_split(void) {
+	uint64_t b, total = 0, per, left;
+	int w = 0;
+	for(b = 0; b < ix.nblocks; b++) if(!*ix_filter(b)) total++;
+	per = (total + nworkers - 1) / nworkers;
+	left = per;
+	workers = calloc(nworkers, sizeof *workers);
+	for(b = 0; b < ix.nblocks; b++) {
+		struct worker *wk = &workers[w];
+		off_t s = b * ix.block, e = s + ix.block + 2;
+		if(*ix_filter(b)) continue;
+		if(e > ix.size) e = ix.size;
+		if(wk->nrg && wk->rg[wk->nrg-1].end == s + 2)
+			wk->rg[wk->nrg-1].end = e;
+		else {
+			wk->rg = realloc(wk->rg, (wk->nrg + 1) * sizeof *wk->rg);
+			wk->rg[wk->nrg++] = (struct range) {s, e, 0};
+		}
+		if(!--left && w < nworkers - 1) {
+			w++;
+			left = per;
+		}
+	}
+	for(w = 0; w < nworkers; w++) {
+		workers[w].id = w;
+		if(workers[w].nrg) workers[w].start = workers[w].rg[0].start;
+	}
+}
+
+static int build_index(off_t size) {
+	int i;
+	if(size == -1) {
+		dprintf(2, "can not index a file of unknown size\n");
+		return 1;
+	}
+	if(ix_open(size, 1)) return 1;
+	ix_split();
+	progress_start();
+	signal(SIGINT, sigint);
+	signal(SIGTERM, sigint);
+	for(i = 0; i < nworkers; i++)
+		if(pthread_create(&workers[i].t, 0, ix_build, &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	for(i = 0; i < nworkers; i++) pthread_join(workers[i].t, 0);
+	progress_stop();
+	if(msync(ix.map, ix.len, MS_SYNC)) perror(ixfile);
+	if(neednl) dprintf(2, "\n");
+	/* past half full most blocks pass for any term */
+	if(ixfull && ixbits * 2 > ixfull * 8 * ix.filter)
+		dprintf(2, "%s: the filters are %d%% full, use a bigger --filter-size\n",
+			ixfile, (int) (ixbits * 100 / (ixfull * 8 * ix.filter)));
+	return interrupted ? 128 + SIGINT : readerr ? 2 : 0;
+}
+
+/* the literal trigrams of pattern p, or -1 if it has none */
+static int ix_trigrams(const struct pattern *p, uint32_t **t) {
+	size_t i, b, run = 0;
+	int n = 0;
+	uint32_t v = 0;
+	*t = malloc(p->len * sizeof **t);
+	for(i = 0; i < p->len; i++) {
+		int lit = 1;
+		if(p->cls) {
+			for(lit = 0, b = 0; b < 256; b++) if(CLS_HAS(p->cls[i], b)) lit++;
+			lit = lit == 1;
+		} else if(p->icase && ((p->s[i] | 0x20) >= 'a' && (p->s[i] | 0x20) <= 'z'))
+			lit = 0;
+		v = (v << 8 | p->s[i]) & 0xffffff;
+		run = lit ? run + 1 : 0;
+		if(run >= 3) (*t)[n++] = v;
+	}
+	return n ? n : -1;
+}
+
+/* replaces the ranges by the parts of them that can contain hits
+   according to the index */
+static int ix_select(off_t size) {
+	struct range *out = 0;
+	uint32_t **tri = calloc(npats, sizeof *tri);
+	int *ntri = calloc(npats, sizeof *ntri);
+	size_t i, j, nout = 0, p;
+	uint64_t b, from = -1, cand = 0, missing = 0;
+	if(size == -1 || ix_open(size, 0)) return -1;
+	for(p = 0; p < npats; p++)
+		if(kerr || pats[p].len > ix.block || (ntri[p] = ix_trigrams(&pats[p], &tri[p])) < 0) {
+			dprintf(2, "not all terms have 3 literal bytes in a row, not using the index\n");
+			return 0;
+		}
+	for(b = 0; b <= ix.nblocks; b++) {
+		int c = 0;
+		if(b < ix.nblocks) {
+			const unsigned char *f = ix_filter(b), *g = b + 1 < ix.nblocks ? ix_filter(b + 1) : 0;
+			if(!*f) missing++;
+			if(!*f || (g && !*g)) c = 1;
+			for(p = 0; p < npats && !c; p++) {
+				for(i = 0; i < ntri[p]; i++) {
+					unsigned h = ix_bit(tri[p][i]);
+					if(!(f[h >> 3] >> (h & 7) & 1) && !(g && g[h >> 3] >> (h & 7) & 1)) break;
+				}
+				c = i == ntri[p];
+			}
+		}
+		if(c) {
+			cand++;
+			if(from == (uint64_t) -1) from = b;
+			continue;
+		}
+		if(from == (uint64_t) -1) continue;
+		/* hits starting in the last candidate block end up to maxlen-1
+		   bytes after it */
+		out = realloc(out, (nout + 1) * sizeof *out);
+		out[nout++] = (struct range) {from * ix.block, b * ix.block + maxlen - 1, 0};
+		from = -1;
+	}
+	if(missing) dprintf(2, "%s: %llu blocks are not indexed yet\n", ixfile, (unsigned long long) missing);
+	else if(ix.nblocks >= 16 && cand * 10 >= ix.nblocks * 9)
+		dprintf(2, "%s: %d%% of the blocks can contain a term, the terms are common or the filters too full\n",
+			ixfile, (int) (cand * 100 / ix.nblocks));
+	/* intersect with the ranges */
+	struct range *rg = 0;
+	size_t n = 0;
+	for(i = j = 0; i < nout && j < nranges; ) {
+		off_t s = out[i].start > ranges[j].start ? out[i].start : ranges[j].start;
+		off_t e = out[i].end < ranges[j].end ? out[i].end : ranges[j].end;
+		if(s < e) {
+			rg = realloc(rg, (n + 1) * sizeof *rg);
+			rg[n++] = (struct range) {s, e, 0};
+		}
+		if(out[i].end < ranges[j].end) i++;
+		else j++;
+	}
+	free(out);
+	free(ranges);
+	ranges = rg;
+	nranges = n;
+	for(p = 0; p < npats; p++) free(tri[p]);
+	free(tri);
+	free(ntri);
+	return 0;
 }
 
 int main(int argc, char **argv) {
-	if(argc != 3) return usage(argv[0]);
-	const char* file = argv[1], *term = argv[2];
-	unsigned char *dblbuf = calloc(1, BLOCKSIZE * 2);
-	unsigned char *readbuf = dblbuf + BLOCKSIZE;
-	size_t termlen = strlen(term);
-	unsigned char *searchbuf = readbuf - termlen;
-	unsigned char *copybuf = readbuf + BLOCKSIZE - termlen;
-	int fd = open(file, O_RDONLY), success=0;
+	int c, resuming = 0, indexing = 0;
+	size_t i;
+	const char *kname = 0;
+	if(argc > 1 && !strcmp(argv[1], "index")) {
+		indexing = 1;
+		argv[1] = argv[0];
+		argc--;
+		argv++;
+	}
+	static const struct option opts[] = {
+		{"patterns", required_argument, 0, 'f'},
+		{"hex", required_argument, 0, 'x'},
+		{"ignore-case", no_argument, 0, 'i'},
+		{"mismatches", required_argument, 0, 'k'},
+		{"encoding", required_argument, 0, 'e'},
+		{"max-hits", required_argument, 0, 'm'},
+		{"first", no_argument, 0, '1'},
+		{"jobs", required_argument, 0, 'j'},
+		{"block-size", required_argument, 0, 'b'},
+		{"queue-depth", required_argument, 0, 'q'},
+		{"direct", no_argument, 0, 'D'},
+		{"no-uring", no_argument, 0, 'U'},
+		{"kernel", required_argument, 0, 'K'},
+		{"bench", no_argument, 0, 'B'},
+		{"no-skip", no_argument, 0, 'Z'},
+		{"checkpoint", required_argument, 0, 'c'},
+		{"resume", no_argument, 0, 'r'},
+		{"carve", required_argument, 0, 'C'},
+		{"carve-dir", required_argument, 0, 'O'},
+		{"partition", required_argument, 0, 'P'},
+		{"unpartitioned", no_argument, 0, 'u'},
+		{"list-partitions", no_argument, 0, 'L'},
+		{"free", no_argument, 0, 'F'},
+		{"index", required_argument, 0, 'I'},
+		{"index-block", required_argument, 0, 256},
+		{"filter-size", required_argument, 0, 257},
+		{"max-rate", required_argument, 0, 258},
+		{"idle", no_argument, 0, 259},
+		{"drop-cache", no_argument, 0, 260},
+		{"progress-fd", required_argument, 0, 261},
+		{"json", no_argument, 0, 262},
+		{0},
+	};
+	while((c = getopt_long(argc, argv, "f:x:ie:k:m:1j:b:q:DUK:BZc:rC:O:P:uLFI:", opts, 0)) != -1) switch(c) {
+	case 'f': if(read_patterns(optarg)) return 1; break;
+	case 'x': if(parse_hex(optarg)) return 1; break;
+	case 'i': icase = 1; break;
+	case 'k': kerr = atoi(optarg); break;
+	case 'e': if(parse_encodings(optarg)) return usage(argv[0]); break;
+	case 'm': maxhits = strtoull(optarg, 0, 0); break;
+	case '1': maxhits = 1; break;
+	case 'j': if((nworkers = atoi(optarg)) < 1) nworkers = 1; break;
+	case 'b': bs = getsz(optarg); break;
+	case 'q': if((depth = atoi(optarg)) < 1) depth = 1; break;
+	case 'D': direct = 1; break;
+	case 'U': use_uring = 0; break;
+	case 'K': kname = optarg; break;
+	case 'B': return bench();
+	case 'Z': sparse = 0; break;
+	case 'c': cpfile = optarg; break;
+	case 'r': resuming = 1; break;
+	case 'C': {
+		char *e = strchr(optarg, ':');
+		if(!e) return usage(argv[0]);
+		carve_before = getsz(optarg);
+		carve_after = getsz(e + 1);
+		carving = 1;
+		break; }
+	case 'O': carve_dir = optarg; break;
+	case 'P':
+		selparts = realloc(selparts, (nselparts + 1) * sizeof *selparts);
+		selparts[nselparts++] = atoi(optarg);
+		break;
+	case 'u': unpart = 1; break;
+	case 'L': listparts = 1; break;
+	case 'F': freeonly = 1; break;
+	case 'I': ixfile = optarg; break;
+	case 256: ix.block = getsz(optarg); break;
+	case 257: ix.filter = getsz(optarg); break;
+	case 258: maxrate = strtod(optarg, 0) * 1024 * 1024; break;
+	case 259: ioidle = 1; break;
+	case 260: dropcache = 1; break;
+	case 261: progfd = atoi(optarg); break;
+	case 262: progjson = 1; break;
+	default: return usage(argv[0]);
+	}
+	if(optind >= argc) return usage(argv[0]);
+	const char* file = argv[optind++];
+	if(indexing) {
+		if(optind != argc - 1) return usage(argv[0]);
+		ixfile = argv[optind++];
+	}
+	if(listparts) {
+		if((fd = open(file, O_RDONLY)) == -1) {
+			perror("open");
+			return 1;
+		}
+		if(read_partitions()) return 1;
+		list_partitions(getsize(fd));
+		return 0;
+	}
+	for(; optind < argc; optind++) add_term(argv[optind]);
+	expand_terms();
+	if(!npats && !indexing) return usage(argv[0]);
+	/* icase text terms together with exact hex terms need byte classes */
+	for(i = 0; i < npats && !pats[i].cls && pats[i].icase == icase; i++);
+	if(i < npats || kerr) {
+		for(i = 0; i < npats; i++) if(kerr < 0 || pats[i].len <= kerr) {
+			dprintf(2, "terms must be longer than the number of mismatches\n");
+			return 1;
+		}
+		piece_build();
+		for(i = 0; i < npats; i++) if(pats[i].len > SAMAXLEN && !(filtered && filtered[i])) {
+			dprintf(2, "terms can be at most %d bytes long with wildcards\n", SAMAXLEN);
+			return 1;
+		}
+		sa_build();
+	} else if(npats > 1 || icase) ac_build(&ac, pats, npats);
+	if(!(find = find_kernel(kname))) {
+		dprintf(2, "kernel %s not available\n", kname);
+		return 1;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	if(__builtin_cpu_supports("avx2")) allzero = allzero_avx2;
+#endif
+	skipzero = sparse && (indexing || !zero_hits());
+	if(!skipzero) sparse = 0;
+	fd = open(file, O_RDONLY);
 	if(fd == -1) {
 		perror("open");
 		return 1;
 	}
-	signal(SIGALRM, sigh);
-	alarm(ATIME);
-	while(1) {
-		ssize_t n = read(fd, readbuf, BLOCKSIZE);
-		if(n <= 0) break;
-		void* res = memmem(searchbuf, BLOCKSIZE+termlen, term, termlen);
-		if(res) {
-			if(neednl) dprintf(2, "\n");
-			neednl = 0;
-			dprintf(1, "bingo: 0x%llx\n", (unsigned long long) offset + ((uintptr_t) res - (uintptr_t)readbuf));
-			fflush(stdout);
-			success = 1;
-		}
-		memcpy(searchbuf, copybuf, termlen);
-		offset += n;
-	}
-	return !success;
+	rfd = fd;
+	if(direct) {
+		bs = (bs + 4095) & ~(size_t) 4095;
+		if((rfd = open(file, O_RDONLY|O_DIRECT)) == -1) {
+			perror("O_DIRECT not supported, using buffered reads");
+			rfd = fd;
+			direct = 0;
+		}
+	}
+	if(!bs) bs = BLOCKSIZE;
+	/* threads created later inherit it */
+	if(ioidle && syscall(SYS_ioprio_set, 1, 0, IOPRIO_IDLE))
+		perror("ioprio_set");
+	pad = (maxlen + 4095) & ~(size_t) 4095;
+	off_t size = fsize = getsize(fd);
+	FILE *cpf = 0;
+	if(indexing) return build_index(size);
+	if(resuming && !cpfile) return usage(argv[0]);
+	if(resuming && size == -1) {
+		dprintf(2, "can not resume a scan of a file of unknown size\n");
+		return 1;
+	}
+	if(nselparts || unpart) {
+		if(select_partitions(size)) return 1;
+	} else add_range(0, size);
+	if(freeonly && (unpart || size == -1)) return usage(argv[0]);
+	if(freeonly && free_ranges()) return 1;
+	if(ixfile && ix_select(size)) return 1;
+	if(!nranges) return 1;
+	if(resuming && resume_open(size, &cpf)) return 1;
+	split_ranges();
+	if(cpf && resume(cpf)) return 1;
+	progress_start();
+	if(cpfile) {
+		signal(SIGINT, sigint);
+		signal(SIGTERM, sigint);
+	}
+	for(i = 0; i < nworkers; i++)
+		if(pthread_create(&workers[i].t, 0, scan, &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	pthread_mutex_lock(&lock);
+	while(ndone < nworkers) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += CPINTERVAL;
+		if(pthread_cond_timedwait(&donecond, &lock, &ts) && cpfile && size != -1) {
+			pthread_mutex_unlock(&lock);
+			checkpoint(size);
+			pthread_mutex_lock(&lock);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	for(i = 0; i < nworkers; i++) pthread_join(workers[i].t, 0);
+	release(LLONG_MAX);
+	progress_stop();
+	if(neednl) dprintf(2, "\n");
+	if(cpfile && size != -1) checkpoint(size);
+	return interrupted ? 128 + SIGINT : readerr ? 2 : !hits;
 }
@@ -0,0 +1,210 @@
+#!/bin/sh
+# checks bdiff output and bdiff -o / bpatch round trips.
+# run from the top directory after make bdiff bpatch.
+BDIFF=${BDIFF:-$PWD/bdiff}
+BPATCH=${BPATCH:-$PWD/bpatch}
+M=1048576
+fail=0
+total=0
+t=`mktemp -d` || exit 1
+trap 'rm -rf "$t"' EXIT
+cd "$t"
+
+# zeros of size $2 into $1
+zeros() {
+	head -c "$2" /dev/zero > "$1"
+}
+
+# writes stdin into $1 at offset $2
+poke() {
+	dd of="$1" bs=65536 seek="$2" oflag=seek_bytes conv=notrunc 2>/dev/null
+}
+
+# runs bdiff with the remaining args and compares its output and
+# exit status with the here document
+expect() {
+	name=$1
+	shift
+	total=$(($total + 1))
+	cat > want
+	"$BDIFF" "$@" > got 2>&1
+	echo "exit $?" >> got
+	if ! cmp -s want got ; then
+		fail=$(($fail + 1))
+		printf "FAIL %s\n" "$name"
+		diff want got
+	fi
+}
+
+# patches $1 to $2 with bdiff -o and bpatch
+roundtrip() {
+	total=$(($total + 1))
+	rm -f p out
+	"$BDIFF" -o p "$1" "$2" > /dev/null
+	if ! "$BPATCH" -o out "$1" p || ! cmp -s out "$2" ; then
+		fail=$(($fail + 1))
+		printf "FAIL roundtrip %s %s (%s -> %s bytes)\n" "$1" "$2" \
+			`wc -c < "$1"` `wc -c < "$2"`
+	fi
+}
+
+printf 'hello world' > a
+printf 'hellO worlD' > b
+# a run up to the end is reported one byte early
+expect "two runs, one at the end" a b << EOF
+difference at offset 4 of size 1
+difference at offset 9 of size 1
+2 differences in 2 out of 11 bytes detected.
+exit 1
+EOF
+
+zeros z1 $((3 * $M))
+cp z1 z2
+printf xyz | poke z2 $(($M - 2))
+printf abcd | poke z2 $((3 * $M - 4))
+for j in 1 3 4 ; do
+expect "runs across 1M and -j $j boundaries and at the end" -j $j z1 z2 << EOF
+difference at offset $(($M - 2)) of size 3
+difference at offset $((3 * $M - 5)) of size 4
+2 differences in 7 out of $((3 * $M)) bytes detected.
+exit 1
+EOF
+done
+
+cp z1 z3
+head -c $(($M + 2)) /dev/zero | tr '\0' q | poke z3 $(($M - 1))
+expect "a run spanning a whole 1M block" -j 3 z1 z3 << EOF
+difference at offset $(($M - 1)) of size $(($M + 2))
+1 differences in $(($M + 2)) out of $((3 * $M)) bytes detected.
+exit 1
+EOF
+
+head -c $((2 * $M + 5)) /dev/urandom > r1
+cp r1 r2
+printf changed | poke r2 7
+printf changed | poke r2 $(($M + 100))
+head -c 1000 /dev/urandom >> r2
+head -c $(($M + 3)) r1 > r3
+: > empty
+roundtrip r1 r2
+roundtrip r2 r1
+roundtrip r1 r3
+roundtrip r3 r1
+roundtrip r1 empty
+roundtrip empty r1
+roundtrip z1 r1
+roundtrip a b
+
+# data inserted into or deleted from the middle is found by -s
+head -c 300000 /dev/urandom > u1
+{ head -c 100000 u1; printf INSERTED; tail -c +100001 u1; } > u2
+{ head -c 100000 u1; tail -c +100101 u1; } > u3
+expect "-s insertion" -s u1 u2 << EOF
+insertion at offset 100000 of size 8 in file2, at offset 100000 in file1
+1 insertions of 8 bytes, 0 deletions of 0 bytes, 0 changes of 0 bytes, 0 moves of 0 bytes, 300000 bytes in place.
+exit 1
+EOF
+expect "-s deletion" -s u1 u3 << EOF
+deletion at offset 100000 of size 100 in file1, at offset 100000 in file2
+0 insertions of 0 bytes, 1 deletions of 100 bytes, 0 changes of 0 bytes, 0 moves of 0 bytes, 299900 bytes in place.
+exit 1
+EOF
+
+# the blocks that differ from a manifest, joined where they touch
+"$BDIFF" -m m1 z1
+"$BDIFF" -j 3 -b 65536 -m m2 z1
+expect "--against 1M blocks" -a m1 z2 << EOF
+difference at offset 0 of size $((3 * $M))
+1 differences in $((3 * $M)) out of $((3 * $M)) bytes detected.
+exit 1
+EOF
+expect "--against 64K blocks" -j 2 -a m2 z2 << EOF
+difference at offset $(($M - 65536)) of size 131072
+difference at offset $((3 * $M - 65536)) of size 65536
+2 differences in 196608 out of $((3 * $M)) bytes detected.
+exit 1
+EOF
+expect "--against the same file" -a m2 z1 << EOF
+0 differences in 0 out of $((3 * $M)) bytes detected.
+exit 0
+EOF
+
+# with more copies, runs split where the set of differing copies
+# changes
+expect "three files" z1 z2 z3 << EOF
+difference at offset $(($M - 2)) of size 1 in 1
+difference at offset $(($M - 1)) of size 2 in 1 2
+difference at offset $(($M + 1)) of size $M in 2
+difference at offset $((3 * $M - 4)) of size 4 in 1
+1 z2: 7 bytes differ
+2 z3: $(($M + 2)) bytes differ
+4 differences in $(($M + 7)) out of $((3 * $M)) bytes detected.
+exit 1
+EOF
+expect "three equal files" z1 z1 z1 << EOF
+0 differences in 0 out of $((3 * $M)) bytes detected.
+exit 0
+EOF
+
+# --sync writes the differing aligned blocks into filename2, joined
+# where they are close, and makes it as long as filename1
+cp z2 s1
+expect "--sync" --sync z1 s1 << EOF
+difference at offset $(($M - 2)) of size 3
+difference at offset $((3 * $M - 5)) of size 4
+12288 bytes written to s1 in 2 writes.
+2 differences in 7 out of $((3 * $M)) bytes detected.
+exit 1
+EOF
+for f in s1 r1 r3 empty ; do
+	cp $f s2
+	total=$(($total + 1))
+	"$BDIFF" -j 3 --sync --min-write 1 r2 s2 > /dev/null
+	if ! cmp -s r2 s2 ; then
+		fail=$(($fail + 1))
+		printf "FAIL --sync %s\n" $f
+	fi
+done
+
+# --quick compares every block when there are fewer than the samples,
+# and stops at the first difference
+cp z1 q1
+expect "--quick equal" --quick z1 q1 << EOF
+equal, all 48 blocks were compared.
+exit 0
+EOF
+expect "--quick different" --quick z1 z2 << EOF
+difference at offset $(($M - 2))
+exit 1
+EOF
+expect "--quick sizes" --quick z1 a << EOF
+sizes differ! $((3 * $M)), 11
+exit 1
+EOF
+total=$(($total + 1))
+if "$BDIFF" -j 3 --quick z1 z3 > /dev/null ; then
+	fail=$(($fail + 1))
+	printf "FAIL --quick -j 3\n"
+fi
+
+# bpatch -o may name the source, and a failed patch leaves the output
+# as it was; -o is refused where no patch could be written
+"$BDIFF" -o p r1 r2 > /dev/null
+cp r1 o1
+cp r3 o2
+total=$(($total + 1))
+if ! "$BPATCH" -o o1 o1 p || ! cmp -s o1 r2 || "$BPATCH" -o o2 r3 p 2> /dev/null ||
+   ! cmp -s o2 r3 ; then
+	fail=$(($fail + 1))
+	printf "FAIL bpatch -o onto an existing file\n"
+fi
+echo keep > o3
+total=$(($total + 1))
+if "$BDIFF" -s -o o3 r1 r2 > /dev/null || "$BDIFF" -o o3 r1 r2 r3 > /dev/null ||
+   [ "`cat o3`" != keep ] ; then
+	fail=$(($fail + 1))
+	printf "FAIL bdiff -o with -s or three files\n"
+fi
+
+printf "%s out of %s checks failed\n" $fail $total >&2
+[ $fail = 0 ]
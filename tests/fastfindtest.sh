@@ -0,0 +1,155 @@
+#!/bin/sh
+# checks that fastfind prints every hit once and in offset order,
+# whatever the jobs, block size, queue depth, skipping or resuming.
+# run from the top directory after make fastfind.
+FASTFIND=${FASTFIND:-$PWD/fastfind}
+K=1024
+M=1048576
+fail=0
+total=0
+t=`mktemp -d` || exit 1
+trap 'rm -rf "$t"' EXIT
+cd "$t"
+
+# writes stdin into $1 at offset $2
+poke() {
+	dd of="$1" bs=65536 seek="$2" oflag=seek_bytes conv=notrunc 2>/dev/null
+}
+
+# text without any of the terms, of size $2 into $1
+filler() {
+	yes 'lorem ipsum dolor sit amet' | head -c "$2" > "$1"
+}
+
+# little endian 32 bit value $1 as printf escapes
+le32() {
+	printf '\\%03o\\%03o\\%03o\\%03o' $(($1 & 255)) $(($1 >> 8 & 255)) \
+		$(($1 >> 16 & 255)) $(($1 >> 24 & 255))
+}
+
+# runs fastfind with the remaining args and compares its output and
+# exit status with the file want
+check() {
+	name=$1
+	shift
+	total=$(($total + 1))
+	"$FASTFIND" "$@" > got 2> /dev/null
+	echo "exit $?" >> got
+	if ! cmp -s want got ; then
+		fail=$(($fail + 1))
+		printf "FAIL %s: %s\n" "$name" "$*"
+		diff want got | head -10
+	fi
+}
+
+# needles across 64K blocks, 1M blocks, the ranges of -j 3 and -j 4,
+# and at the very end. at two of them a haystack comes before the
+# needle, with terms that start before others but end after them.
+filler f $((3 * $M))
+: > want
+for o in 0 $((64 * $K - 3)) 500000 $((768 * $K - 2)) $(($M - 3)) \
+	$(($M + 100)) $((1536 * $K - 1)) $((2 * $M - 5)) \
+	$((2304 * $K - 2)) $((3 * $M - 6)) ; do
+	printf needle | poke f $o
+	if [ $o = 500000 ] || [ $o = $(($M + 100)) ] ; then
+		printf haystack | poke f $(($o - 8))
+		printf "bingo: 0x%x haystack\n" $(($o - 8)) >> want
+		printf "bingo: 0x%x haystackneedle\n" $(($o - 8)) >> want
+		printf "bingo: 0x%x stack\n" $(($o - 5)) >> want
+		printf "bingo: 0x%x ackneedle\n" $(($o - 3)) >> want
+	fi
+	printf "bingo: 0x%x needle\n" $o >> want
+done
+echo "exit 0" >> want
+for opt in "" "-j 3" "-j 4" "-j 4 -b 4096" "-b 5000 -q 1" "-j 2 -q 8 -U" \
+	"-j 7 -b 100000" ; do
+	check "order and block boundaries" $opt f needle haystack haystackneedle ackneedle stack
+done
+
+# the same offsets through the wildcard matcher, with the first hit
+# only once
+grep ' needle$' want | sed 's/ needle$//' > w
+echo "exit 0" >> w
+mv w want
+for opt in "" "-j 3 -b 4096" ; do
+	check "wildcards" $opt f -x 6e65??646c65
+done
+echo "bingo: 0x0" > want
+echo "exit 0" >> want
+check "first hit" -j 4 -1 f -x 6e65??646c65
+
+# of the gap variants of a hex term, one hit per start
+printf 'xxabcxxadxxabbc' > g
+cat > want << EOF
+bingo: 0x2 61 [0-2] ??
+bingo: 0x7 61 [0-2] ??
+bingo: 0xb 61 [0-2] ??
+exit 0
+EOF
+check "gap variants" g -x '61 [0-2] ??'
+cat > want << EOF
+bingo: 0x2 61 [0-2] 63
+bingo: 0xb 61 [0-2] 63
+exit 0
+EOF
+check "gap variants with a tail" g -x '61 [0-2] 63'
+
+# an interrupted scan resumed from its checkpoint prints what an
+# uninterrupted one does
+"$FASTFIND" -j 3 f needle haystack haystackneedle ackneedle stack > want 2> /dev/null
+echo "exit 0" >> want
+rm -f ck
+"$FASTFIND" -j 3 --max-rate 1 -c ck f needle haystack haystackneedle ackneedle stack > /dev/null 2>&1 &
+sleep 1
+kill -INT $!
+wait $!
+check "resume" -j 3 -c ck -r f needle haystack haystackneedle ackneedle stack
+
+# holes and zero blocks are skipped unless -Z, but hits next to them
+# and hits of zeros are found either way
+: > s
+truncate -s $((8 * $M)) s
+filler d $((200 * $K))
+poke s $((2 * $M)) < d
+poke s $((5 * $M + 3)) < d
+for o in $((2 * $M - 3)) $((2 * $M + 1000)) $((5 * $M)) $((8 * $M - 6)) ; do
+	printf needle | poke s $o
+done
+"$FASTFIND" -Z s needle > want 2> /dev/null
+echo "exit 0" >> want
+[ `wc -l < want` = 5 ] || { echo "FAIL sparse: `cat want`"; fail=$(($fail + 1)); }
+check "sparse" s needle
+check "sparse" -j 3 -b 4096 s needle
+"$FASTFIND" -Z s -x '000000006e' > want 2> /dev/null
+echo "exit 0" >> want
+check "sparse with zero terms" -j 2 s -x '000000006e'
+
+# partitions 1 and 2 touch at 2M, a needle crosses from one to the
+# other and is found when both are scanned
+: > p
+truncate -s $((4 * $M)) p
+{
+	printf "\\000\\000\\000\\000\\203\\000\\000\\000`le32 2048``le32 2048`"
+	printf "\\000\\000\\000\\000\\203\\000\\000\\000`le32 4096``le32 2048`"
+} | poke p 446
+printf '\125\252' | poke p 510
+printf needle | poke p $((2 * $M - 3))
+printf needle | poke p $((3 * $M + 7))
+cat > want << EOF
+bingo: 0x1ffffd partition 1+0xffffd
+exit 0
+EOF
+check "partitions" -P 1 -P 2 p needle
+check "partitions" -j 2 -b 4096 -P 1 -P 2 p needle
+cat > want << EOF
+exit 1
+EOF
+check "partitions" -P 1 p needle
+cat > want << EOF
+bingo: 0x300007
+exit 0
+EOF
+check "unpartitioned" -u p needle
+
+printf "%s out of %s checks failed\n" $fail $total >&2
+[ $fail = 0 ]